@@ -0,0 +1,412 @@
+// Allocator simulation and fragmentation benchmark.
+//
+// Replays synthetic or recorded create/edit/delete traces against FreeSpaceBitmap
+// and alternative allocation policies, without the server or a container file.
+//
+//   ofs_alloc_bench [--blocks N] [--block-size B] [--ops N] [--fill PCT]
+//                   [--seed S] [--sizes FILE] [--trace FILE]
+//
+// --sizes FILE   one file size in bytes per line (e.g. `find /data -type f -printf "%s\n"`);
+//                synthetic workloads sample from it instead of the built-in distribution.
+// --trace FILE   lines of "C <id> <bytes>", "E <id> <bytes>" or "D <id>", replayed as-is.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../data_structures/free_space_bitmap.hpp"
+
+using namespace std;
+
+class Allocator {
+public:
+    virtual ~Allocator() {}
+    virtual const char* name() const = 0;
+    virtual void reset(size_t num_blocks) = 0;
+    virtual long allocate(size_t num_blocks) = 0;
+    virtual void release(long start, size_t num_blocks) = 0;
+    virtual double fragmentation() const = 0;
+    virtual size_t memoryBytes() const = 0;
+};
+
+// Rough per-node cost of a std::map/std::set entry on 64-bit libstdc++.
+static const size_t TREE_NODE_BYTES = 48;
+
+// The production allocator: first fit over the free-run index.
+class BitmapFirstFit : public Allocator {
+    FreeSpaceBitmap bitmap;
+public:
+    const char* name() const override { return "bitmap-first-fit"; }
+    void reset(size_t num_blocks) override { bitmap.initialize(num_blocks); }
+    long allocate(size_t num_blocks) override {
+        int start = bitmap.findFreeBlocks(num_blocks);
+        if (start == -1) return -1;
+        bitmap.setBlocks(start, num_blocks);
+        return start;
+    }
+    void release(long start, size_t num_blocks) override { bitmap.freeBlocks(start, num_blocks); }
+    double fragmentation() const override { return bitmap.fragmentation(); }
+    size_t memoryBytes() const override {
+        size_t runs = bitmap.freeExtentCount();
+        return bitmap.size() / 8 + runs * 2 * TREE_NODE_BYTES;
+    }
+};
+
+// The original allocator: linear bit scan for the first fitting run.
+class LinearScanFirstFit : public Allocator {
+protected:
+    vector<bool> bits;
+    size_t free_blocks = 0;
+
+    long scan(size_t from, size_t to, size_t num_blocks) const {
+        size_t consecutive_free = 0;
+        for (size_t i = from; i < to; ++i) {
+            if (bits[i]) { consecutive_free = 0; continue; }
+            if (++consecutive_free == num_blocks) return i - num_blocks + 1;
+        }
+        return -1;
+    }
+    void mark(long start, size_t num_blocks, bool used) {
+        for (size_t i = 0; i < num_blocks; ++i) bits[start + i] = used;
+        free_blocks = used ? free_blocks - num_blocks : free_blocks + num_blocks;
+    }
+public:
+    const char* name() const override { return "linear-first-fit"; }
+    void reset(size_t num_blocks) override { bits.assign(num_blocks, false); free_blocks = num_blocks; }
+    long allocate(size_t num_blocks) override {
+        long start = scan(0, bits.size(), num_blocks);
+        if (start != -1) mark(start, num_blocks, true);
+        return start;
+    }
+    void release(long start, size_t num_blocks) override { mark(start, num_blocks, false); }
+    double fragmentation() const override {
+        size_t largest = 0, run = 0;
+        for (size_t i = 0; i < bits.size(); ++i) {
+            run = bits[i] ? 0 : run + 1;
+            largest = max(largest, run);
+        }
+        return free_blocks == 0 ? 0.0 : 100.0 * (1.0 - (double)largest / free_blocks);
+    }
+    size_t memoryBytes() const override { return bits.size() / 8; }
+};
+
+// Next fit: resumes the scan where the previous allocation ended.
+class LinearScanNextFit : public LinearScanFirstFit {
+    size_t cursor = 0;
+public:
+    const char* name() const override { return "linear-next-fit"; }
+    void reset(size_t num_blocks) override { LinearScanFirstFit::reset(num_blocks); cursor = 0; }
+    long allocate(size_t num_blocks) override {
+        long start = scan(cursor, bits.size(), num_blocks);
+        if (start == -1) start = scan(0, bits.size(), num_blocks);
+        if (start == -1) return -1;
+        mark(start, num_blocks, true);
+        cursor = start + num_blocks;
+        return start;
+    }
+};
+
+// Best fit: smallest free run that is large enough, indexed by (length, start).
+class BestFit : public Allocator {
+    map<size_t, size_t> runs_by_start;
+    set<pair<size_t, size_t>> runs_by_length;
+    size_t free_blocks = 0;
+
+    void addRun(size_t start, size_t length) {
+        runs_by_start[start] = length;
+        runs_by_length.insert({length, start});
+    }
+    void eraseRun(map<size_t, size_t>::iterator it) {
+        runs_by_length.erase({it->second, it->first});
+        runs_by_start.erase(it);
+    }
+public:
+    const char* name() const override { return "best-fit"; }
+    void reset(size_t num_blocks) override {
+        runs_by_start.clear();
+        runs_by_length.clear();
+        addRun(0, num_blocks);
+        free_blocks = num_blocks;
+    }
+    long allocate(size_t num_blocks) override {
+        auto fit = runs_by_length.lower_bound({num_blocks, 0});
+        if (fit == runs_by_length.end()) return -1;
+        size_t start = fit->second, length = fit->first;
+        eraseRun(runs_by_start.find(start));
+        if (length > num_blocks) addRun(start + num_blocks, length - num_blocks);
+        free_blocks -= num_blocks;
+        return start;
+    }
+    void release(long start, size_t num_blocks) override {
+        size_t s = start, e = start + num_blocks;
+        auto right = runs_by_start.find(e);
+        if (right != runs_by_start.end()) { e += right->second; eraseRun(right); }
+        auto left = runs_by_start.lower_bound(s);
+        if (left != runs_by_start.begin()) {
+            --left;
+            if (left->first + left->second == s) { s = left->first; eraseRun(left); }
+        }
+        addRun(s, e - s);
+        free_blocks += num_blocks;
+    }
+    double fragmentation() const override {
+        if (free_blocks == 0 || runs_by_length.empty()) return 0.0;
+        return 100.0 * (1.0 - (double)runs_by_length.rbegin()->first / free_blocks);
+    }
+    size_t memoryBytes() const override { return runs_by_start.size() * 2 * TREE_NODE_BYTES; }
+};
+
+struct TraceOp {
+    char kind;          // 'C'reate, 'E'dit (rewrite at new size), 'D'elete
+    uint64_t id;
+    uint64_t bytes;
+};
+
+// Coarse file-size distribution (bytes, cumulative share) after published desktop
+// file-system metadata studies: most files are small, most bytes are in large files.
+static const pair<uint64_t, double> DEFAULT_SIZE_CDF[] = {
+    {0, 0.02}, {128, 0.10}, {512, 0.22}, {2048, 0.40}, {4096, 0.52}, {16384, 0.72},
+    {65536, 0.86}, {262144, 0.94}, {1048576, 0.98}, {8388608, 0.998}, {67108864, 1.0},
+};
+
+class SizeSampler {
+    vector<uint64_t> samples;
+    mt19937_64& rng;
+public:
+    SizeSampler(mt19937_64& r) : rng(r) {}
+
+    bool load(const string& path) {
+        ifstream in(path);
+        if (!in) return false;
+        uint64_t size;
+        while (in >> size) samples.push_back(size);
+        return !samples.empty();
+    }
+
+    uint64_t next() {
+        if (!samples.empty()) return samples[rng() % samples.size()];
+        double u = uniform_real_distribution<double>(0.0, 1.0)(rng);
+        uint64_t low = 0;
+        for (const auto& bucket : DEFAULT_SIZE_CDF) {
+            if (u <= bucket.second) {
+                if (bucket.first <= low) return bucket.first;
+                return low + rng() % (bucket.first - low);
+            }
+            low = bucket.first;
+        }
+        return low;
+    }
+};
+
+struct BenchConfig {
+    size_t num_blocks = 25600;
+    size_t block_size = 4096;
+    size_t churn_ops = 200000;
+    double churn_fill = 0.80;
+    uint64_t seed = 42;
+    string sizes_path;
+    string trace_path;
+};
+
+static vector<TraceOp> make_fill_trace(const BenchConfig& cfg, SizeSampler& sizes) {
+    vector<TraceOp> trace;
+    uint64_t capacity = (uint64_t)cfg.num_blocks * cfg.block_size;
+    uint64_t requested = 0;
+    for (uint64_t id = 0; requested < capacity * 4; ++id) {
+        uint64_t bytes = sizes.next();
+        trace.push_back({'C', id, bytes});
+        requested += max<uint64_t>(bytes, 1);
+    }
+    return trace;
+}
+
+static vector<TraceOp> make_churn_trace(const BenchConfig& cfg, SizeSampler& sizes, mt19937_64& rng) {
+    vector<TraceOp> trace;
+    vector<pair<uint64_t, uint64_t>> live;    // (id, bytes)
+    uint64_t target = (uint64_t)(cfg.num_blocks * cfg.block_size * cfg.churn_fill);
+    uint64_t live_bytes = 0, next_id = 0;
+
+    while (live_bytes < target) {
+        uint64_t bytes = sizes.next();
+        trace.push_back({'C', next_id, bytes});
+        live.push_back({next_id++, bytes});
+        live_bytes += bytes;
+    }
+    for (size_t op = 0; op < cfg.churn_ops; ++op) {
+        size_t pick = live.empty() ? 0 : rng() % live.size();
+        unsigned roll = rng() % 10;
+        if (!live.empty() && (live_bytes > target || roll < 4)) {
+            trace.push_back({'D', live[pick].first, 0});
+            live_bytes -= live[pick].second;
+            live[pick] = live.back();
+            live.pop_back();
+        } else if (!live.empty() && roll < 6) {
+            uint64_t bytes = sizes.next();
+            trace.push_back({'E', live[pick].first, bytes});
+            live_bytes = live_bytes - live[pick].second + bytes;
+            live[pick].second = bytes;
+        } else {
+            uint64_t bytes = sizes.next();
+            trace.push_back({'C', next_id, bytes});
+            live.push_back({next_id++, bytes});
+            live_bytes += bytes;
+        }
+    }
+    return trace;
+}
+
+static bool load_trace(const string& path, vector<TraceOp>& trace) {
+    ifstream in(path);
+    if (!in) return false;
+    string line;
+    while (getline(in, line)) {
+        stringstream ss(line);
+        TraceOp op = {0, 0, 0};
+        string kind;
+        if (!(ss >> kind >> op.id)) continue;
+        op.kind = kind[0];
+        if (op.kind != 'D' && !(ss >> op.bytes)) continue;
+        trace.push_back(op);
+    }
+    return !trace.empty();
+}
+
+struct RunResult {
+    vector<double> latencies_ns;
+    uint64_t attempts[10] = {0};      // Allocation attempts per 10% fill band
+    uint64_t failures[10] = {0};
+    vector<pair<size_t, double>> fragmentation_samples;
+    size_t peak_memory = 0;
+};
+
+static RunResult replay(Allocator& alloc, const BenchConfig& cfg, const vector<TraceOp>& trace) {
+    RunResult result;
+    unordered_map<uint64_t, pair<long, size_t>> files;     // id -> (start, blocks)
+    size_t used_blocks = 0;
+    size_t sample_every = max<size_t>(trace.size() / 20, 1);
+    alloc.reset(cfg.num_blocks);
+
+    auto blocks_for = [&](uint64_t bytes) {
+        return bytes == 0 ? (size_t)1 : (size_t)((bytes + cfg.block_size - 1) / cfg.block_size);
+    };
+    auto allocate = [&](uint64_t id, uint64_t bytes) {
+        size_t blocks = blocks_for(bytes);
+        int band = min(9, (int)(10 * used_blocks / cfg.num_blocks));
+        auto t0 = chrono::steady_clock::now();
+        long start = alloc.allocate(blocks);
+        auto t1 = chrono::steady_clock::now();
+        result.latencies_ns.push_back((double)chrono::duration_cast<chrono::nanoseconds>(t1 - t0).count());
+        result.attempts[band]++;
+        if (start == -1) { result.failures[band]++; return; }
+        files[id] = {start, blocks};
+        used_blocks += blocks;
+    };
+    auto release = [&](uint64_t id) {
+        auto it = files.find(id);
+        if (it == files.end()) return;
+        alloc.release(it->second.first, it->second.second);
+        used_blocks -= it->second.second;
+        files.erase(it);
+    };
+
+    for (size_t i = 0; i < trace.size(); ++i) {
+        const TraceOp& op = trace[i];
+        if (op.kind == 'C' && files.find(op.id) == files.end()) {
+            allocate(op.id, op.bytes);
+        } else if (op.kind == 'E') {
+            release(op.id);
+            allocate(op.id, op.bytes);
+        } else if (op.kind == 'D') {
+            release(op.id);
+        }
+        if (i % sample_every == 0 || i + 1 == trace.size()) {
+            result.fragmentation_samples.push_back({i, alloc.fragmentation()});
+            result.peak_memory = max(result.peak_memory, alloc.memoryBytes());
+        }
+    }
+    return result;
+}
+
+static double percentile(vector<double>& values, double p) {
+    if (values.empty()) return 0.0;
+    size_t idx = min(values.size() - 1, (size_t)(p / 100.0 * values.size()));
+    nth_element(values.begin(), values.begin() + idx, values.end());
+    return values[idx];
+}
+
+static void report(const string& workload, Allocator& alloc, RunResult& r) {
+    printf("\n[%s] %s\n", workload.c_str(), alloc.name());
+    printf("  alloc latency ns: p50=%.0f p90=%.0f p99=%.0f max=%.0f (%zu calls)\n",
+           percentile(r.latencies_ns, 50), percentile(r.latencies_ns, 90),
+           percentile(r.latencies_ns, 99), percentile(r.latencies_ns, 100), r.latencies_ns.size());
+    printf("  failure rate by fill level:");
+    for (int band = 0; band < 10; ++band) {
+        if (r.attempts[band] == 0) continue;
+        printf(" %d-%d%%:%.1f%%", band * 10, band * 10 + 10, 100.0 * r.failures[band] / r.attempts[band]);
+    }
+    printf("\n  fragmentation over time (op:%%):");
+    for (const auto& sample : r.fragmentation_samples) printf(" %zu:%.1f", sample.first, sample.second);
+    printf("\n  peak allocator memory: %zu bytes (estimated)\n", r.peak_memory);
+}
+
+int main(int argc, char** argv) {
+    BenchConfig cfg;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string key = argv[i], value = argv[i + 1];
+        if (key == "--blocks") cfg.num_blocks = stoull(value);
+        else if (key == "--block-size") cfg.block_size = stoull(value);
+        else if (key == "--ops") cfg.churn_ops = stoull(value);
+        else if (key == "--fill") cfg.churn_fill = stod(value) / 100.0;
+        else if (key == "--seed") cfg.seed = stoull(value);
+        else if (key == "--sizes") cfg.sizes_path = value;
+        else if (key == "--trace") cfg.trace_path = value;
+        else { cerr << "Unknown option " << key << endl; return 1; }
+    }
+
+    mt19937_64 rng(cfg.seed);
+    SizeSampler sizes(rng);
+    if (!cfg.sizes_path.empty() && !sizes.load(cfg.sizes_path)) {
+        cerr << "Could not load sizes from " << cfg.sizes_path << endl;
+        return 1;
+    }
+
+    vector<pair<string, vector<TraceOp>>> workloads;
+    if (!cfg.trace_path.empty()) {
+        vector<TraceOp> trace;
+        if (!load_trace(cfg.trace_path, trace)) {
+            cerr << "Could not load trace from " << cfg.trace_path << endl;
+            return 1;
+        }
+        workloads.push_back({"trace " + cfg.trace_path, trace});
+    } else {
+        workloads.push_back({"fill-to-full", make_fill_trace(cfg, sizes)});
+        workloads.push_back({"steady-churn", make_churn_trace(cfg, sizes, rng)});
+    }
+
+    vector<unique_ptr<Allocator>> allocators;
+    allocators.emplace_back(new BitmapFirstFit());
+    allocators.emplace_back(new LinearScanFirstFit());
+    allocators.emplace_back(new LinearScanNextFit());
+    allocators.emplace_back(new BestFit());
+
+    printf("blocks=%zu block_size=%zu seed=%llu\n", cfg.num_blocks, cfg.block_size, (unsigned long long)cfg.seed);
+    for (auto& workload : workloads) {
+        for (auto& alloc : allocators) {
+            RunResult result = replay(*alloc, cfg, workload.second);
+            report(workload.first, *alloc, result);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,116 @@
+// Check of 64-bit block addressing on a sparse container larger than 4 GiB.
+//
+// Formats a 5 GiB container, places a file in the large-block region (which starts
+// past 4 GiB here), writes a sparse file at a logical offset past 4 GiB, then
+// remounts and reads both back. The container stays sparse, so only a few
+// megabytes of host disk are used.
+//
+//   ofs_large_container_check [DIR]     (default /tmp)
+//
+// Exits 0 when every check passes.
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+
+#include "../core/ofs_api.hpp"
+#include "../core/ofs_internal.hpp"
+
+using namespace std;
+
+static const uint64_t CONTAINER_BYTES = 5ull << 30;
+static const uint64_t FOUR_GIB = 4ull << 30;
+
+static int failures = 0;
+
+static void check(bool ok, const string& what) {
+    cout << (ok ? "  ok    " : "  FAIL  ") << what << endl;
+    if (!ok) failures++;
+}
+
+static string pattern(size_t size, char seed) {
+    string data(size, '\0');
+    for (size_t i = 0; i < size; ++i) data[i] = (char)(seed + i % 251);
+    return data;
+}
+
+static bool read_matches(void* fs, const char* path, uint64_t offset, const string& expected) {
+    char* buffer = nullptr;
+    size_t size = 0;
+    if (file_read_range(fs, path, offset, expected.size(), &buffer, &size) != (int)OFSErrorCodes::SUCCESS) return false;
+    bool same = size == expected.size() && string(buffer, size) == expected;
+    free_buffer(buffer);
+    return same;
+}
+
+static bool write_config(const string& path) {
+    ofstream config(path);
+    config << "[filesystem]\n"
+           << "total_size = " << CONTAINER_BYTES << "\n"
+           << "header_size = 512\nblock_size = 4096\nmax_files = 100\nmax_filename_length = 10\n"
+           << "[security]\nmax_users = 5\nadmin_username = \"admin\"\nadmin_password = \"admin123\"\nrequire_auth = true\n"
+           << "[server]\nport = 8081\nmax_connections = 20\nqueue_timeout = 30\n"
+           << "[storage]\n"
+           << "large_block_size = 262144\n"
+           << "large_region_percent = 10\n"   // Region starts at 4.5 GiB
+           << "large_file_min_bytes = 1048576\n";
+    return (bool)config;
+}
+
+int main(int argc, char** argv) {
+    string dir = argc > 1 ? argv[1] : "/tmp";
+    string omni_path = dir + "/ofs_large_check.omni";
+    string config_path = dir + "/ofs_large_check.uconf";
+    if (!write_config(config_path)) {
+        cerr << "cannot write " << config_path << endl;
+        return 1;
+    }
+
+    cout << "Formatting a " << (CONTAINER_BYTES >> 30) << " GiB sparse container at " << omni_path << endl;
+    check(fs_format(omni_path, config_path) == (int)OFSErrorCodes::SUCCESS, "fs_format");
+    void* fs = nullptr;
+    if (fs_init(&fs, omni_path, config_path) != (int)OFSErrorCodes::SUCCESS) {
+        check(false, "fs_init");
+        return 1;
+    }
+
+    FSStats stats;
+    check(get_stats(fs, &stats) == (int)OFSErrorCodes::SUCCESS && stats.total_size == CONTAINER_BYTES, "total_size is 5 GiB");
+
+    string big = pattern(2 << 20, 'a');
+    check(file_create(fs, "/big", big.data(), big.size()) == (int)OFSErrorCodes::SUCCESS, "create a 2 MiB file");
+    fs_flush_delayed(fs, true);
+    FSTreeNode* node = find_node_by_path(((OFSInstance*)fs)->fsTree.root, "/big");
+    uint64_t disk_offset = node && !node->extents.empty() ? node->extents.firstBlock() * 4096ull : 0;
+    check(disk_offset >= FOUR_GIB, "its blocks lie past 4 GiB (offset " + to_string(disk_offset) + ")");
+
+    string far = pattern(10000, 'k');
+    uint64_t far_offset = FOUR_GIB + 12345;
+    check(file_create(fs, "/sparse", nullptr, 0) == (int)OFSErrorCodes::SUCCESS, "create a sparse file");
+    check(file_edit(fs, "/sparse", far.data(), far.size(), far_offset) == (int)OFSErrorCodes::SUCCESS, "write at logical offset 4 GiB + 12345");
+
+    fs_shutdown(fs);
+    fs = nullptr;
+    check(fs_init(&fs, omni_path, config_path) == (int)OFSErrorCodes::SUCCESS, "remount");
+    if (fs == nullptr) return 1;
+
+    check(read_matches(fs, "/big", 0, big), "large-region file reads back");
+    FileMetadata meta;
+    check(get_metadata(fs, "/sparse", &meta) == (int)OFSErrorCodes::SUCCESS && meta.entry.size == far_offset + far.size(),
+          "sparse file size is past 4 GiB");
+    check(read_matches(fs, "/sparse", far_offset, far), "data past 4 GiB reads back");
+    check(read_matches(fs, "/sparse", 1ull << 30, string(4096, '\0')), "hole reads as zeroes");
+    fs_shutdown(fs);
+
+    struct stat st;
+    check(stat(omni_path.c_str(), &st) == 0 && (uint64_t)st.st_size == CONTAINER_BYTES, "container file is 5 GiB long");
+    check((uint64_t)st.st_blocks * 512 < (256ull << 20), "container stays sparse on the host (" + to_string(st.st_blocks * 512) + " bytes used)");
+
+    remove(omni_path.c_str());
+    remove(config_path.c_str());
+    cout << (failures == 0 ? "PASS" : "FAIL") << endl;
+    return failures == 0 ? 0 : 1;
+}
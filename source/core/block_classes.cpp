@@ -0,0 +1,119 @@
+#include "ofs_api.hpp"
+#include "ofs_internal.hpp"
+#include <algorithm>
+
+using namespace std;
+
+// The large-block region is tracked in units of large_unit blocks. Files placed
+// there always map whole units, so a unit is free exactly when none of its blocks
+// belongs to a file.
+
+bool in_large_region(OFSInstance* fs_instance, size_t block) {
+    return fs_instance->large_unit > 0 && block >= fs_instance->large_start &&
+           block < fs_instance->large_start + fs_instance->large_bitmap.size() * fs_instance->large_unit;
+}
+
+bool is_large_file(OFSInstance* fs_instance, FSTreeNode* node) {
+    return !node->extents.empty() && in_large_region(fs_instance, node->extents.firstBlock());
+}
+
+bool wants_large_blocks(OFSInstance* fs_instance, size_t size) {
+    return fs_instance->large_unit > 0 && fs_instance->config.large_file_min_bytes > 0 &&
+           size >= fs_instance->config.large_file_min_bytes;
+}
+
+size_t class_blocks(OFSInstance* fs_instance, FSTreeNode* node, size_t blocks) {
+    if (!is_large_file(fs_instance, node)) return blocks;
+    size_t unit = fs_instance->large_unit;
+    return (blocks + unit - 1) / unit * unit;
+}
+
+size_t large_free_blocks(OFSInstance* fs_instance) {
+    return fs_instance->large_bitmap.freeBlockCount() * fs_instance->large_unit;
+}
+
+// Claims whole large blocks covering blocks, in one run; with allow_partial, the
+// largest free run is taken when no run is long enough. run receives the length.
+int64_t alloc_large_run(OFSInstance* fs_instance, size_t blocks, size_t& run, bool allow_partial) {
+    if (fs_instance->large_unit == 0 || blocks == 0) return -1;
+    size_t unit = fs_instance->large_unit;
+    size_t units = (blocks + unit - 1) / unit;
+    if (allow_partial) units = min(units, fs_instance->large_bitmap.largestFreeExtent());
+    int64_t first_unit = units > 0 ? fs_instance->large_bitmap.findFreeBlocks(units) : -1;
+    if (first_unit == -1) return -1;
+
+    fs_instance->large_bitmap.setBlocks(first_unit, units);
+    run = units * unit;
+    return fs_instance->large_start + (size_t)first_unit * unit;
+}
+
+// Claims up to max_blocks of free large blocks starting at next_block, which must
+// begin a unit.
+size_t claim_large_after(OFSInstance* fs_instance, size_t next_block, size_t max_blocks) {
+    if (!in_large_region(fs_instance, next_block)) return 0;
+    size_t unit = fs_instance->large_unit;
+    size_t first_unit = (next_block - fs_instance->large_start) / unit;
+    size_t units = 0;
+    while (units < max_blocks / unit && first_unit + units < fs_instance->large_bitmap.size() &&
+           !fs_instance->large_bitmap.isBlockSet(first_unit + units)) {
+        units++;
+    }
+    if (units > 0) fs_instance->large_bitmap.setBlocks(first_unit, units);
+    return units * unit;
+}
+
+// Blocks added by fs_grow lie past the region and belong to the main bitmap again.
+void free_block_run(OFSInstance* fs_instance, size_t start, size_t length) {
+    queue_punch(fs_instance, start, length);
+    fs_instance->block_cache.invalidate(start, length);
+    size_t end = start + length;
+    size_t unit = fs_instance->large_unit;
+    if (unit == 0) {
+        fs_instance->bitmap.freeBlocks(start, length);
+        return;
+    }
+    size_t region_start = fs_instance->large_start;
+    size_t region_end = region_start + fs_instance->large_bitmap.size() * unit;
+    if (start < region_start) fs_instance->bitmap.freeBlocks(start, min(end, region_start) - start);
+    if (end > region_end) fs_instance->bitmap.freeBlocks(max(start, region_end), end - max(start, region_end));
+
+    size_t first = max(start, region_start);
+    size_t last = min(end, region_end);
+    if (last <= first) return;
+    size_t first_unit = (first - region_start + unit - 1) / unit;
+    size_t end_unit = (last - region_start) / unit;
+    if (end_unit > first_unit) fs_instance->large_bitmap.freeBlocks(first_unit, end_unit - first_unit);
+}
+
+// Files that have grown past large_file_min_bytes in the small-block region are
+// moved by the defragmenter on its next pass.
+void note_large_candidate(OFSInstance* fs_instance, FSTreeNode* node) {
+    if (wants_large_blocks(fs_instance, node->metadata.size) && !node->extents.empty() && !is_large_file(fs_instance, node)) {
+        fs_instance->defrag.large_candidates = true;
+    }
+}
+
+// Splits the region off the main bitmap once it has been loaded from disk: a unit is
+// in use when any of its blocks is.
+void init_block_classes(OFSInstance* fs_instance, size_t large_block_size, size_t region_start, size_t region_blocks) {
+    size_t block_size = fs_instance->config.block_size;
+    size_t unit = block_size > 0 ? large_block_size / block_size : 0;
+    if (unit < 2 || large_block_size % block_size != 0 || region_blocks < unit ||
+        region_start + region_blocks > fs_instance->bitmap.size()) return;
+
+    size_t units = region_blocks / unit;
+    fs_instance->large_unit = unit;
+    fs_instance->large_start = region_start;
+    fs_instance->large_bitmap.initialize(units);
+    for (size_t u = 0; u < units; ++u) {
+        size_t first = fs_instance->large_start + u * unit;
+        for (size_t b = first; b < first + unit; ++b) {
+            if (fs_instance->bitmap.isBlockSet(b)) {
+                fs_instance->large_bitmap.setBlock(u);
+                break;
+            }
+        }
+    }
+    fs_instance->bitmap.setBlocks(fs_instance->large_start, units * unit);
+    fs_instance->defrag.large_candidates = true;
+}
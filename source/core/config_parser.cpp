@@ -52,6 +52,31 @@ bool parse_config(const string& config_path, Config& config)
             else if (key == "port") config.port = stoi(value);
             else if (key == "max_connections") config.max_connections = stoi(value);
             else if (key == "queue_timeout") config.queue_timeout = stoi(value);
+            else if (key == "delayed_allocation") config.delayed_allocation = (value == "true");
+            else if (key == "delalloc_flush_ms") config.delalloc_flush_ms = stoi(value);
+            else if (key == "delalloc_max_pending_bytes") config.delalloc_max_pending_bytes = stoull(value);
+            else if (key == "append_prealloc_max_blocks") config.append_prealloc_max_blocks = stoi(value);
+            else if (key == "append_trim_idle_ms") config.append_trim_idle_ms = stoi(value);
+            else if (key == "inline_max_bytes") config.inline_max_bytes = stoi(value);
+            else if (key == "fragment_size") config.fragment_size = stoi(value);
+            else if (key == "tail_pack_max_bytes") config.tail_pack_max_bytes = stoi(value);
+            else if (key == "large_block_size") config.large_block_size = stoull(value);
+            else if (key == "large_region_percent") config.large_region_percent = stoi(value);
+            else if (key == "large_file_min_bytes") config.large_file_min_bytes = stoull(value);
+            else if (key == "block_cache_bytes") config.block_cache_bytes = stoull(value);
+            else if (key == "readahead_max_blocks") config.readahead_max_blocks = stoi(value);
+            else if (key == "write_back") config.write_back = (value == "true");
+            else if (key == "write_back_max_dirty_bytes") config.write_back_max_dirty_bytes = stoull(value);
+            else if (key == "write_back_flush_ms") config.write_back_flush_ms = stoi(value);
+            else if (key == "file_cache_bytes") config.file_cache_bytes = stoull(value);
+            else if (key == "file_cache_max_file_bytes") config.file_cache_max_file_bytes = stoull(value);
+            else if (key == "direct_io") config.direct_io = (value == "true");
+            else if (key == "defrag_enabled") config.defrag_enabled = (value == "true");
+            else if (key == "defrag_blocks_per_step") config.defrag_blocks_per_step = stoi(value);
+            else if (key == "defrag_min_fragmentation") config.defrag_min_fragmentation = stod(value);
+            else if (key == "punch_freed_blocks") config.punch_freed_blocks = (value == "true");
+            else if (key == "punch_blocks_per_step") config.punch_blocks_per_step = stoi(value);
+            else if (key == "maintenance_interval_ms") config.maintenance_interval_ms = stoi(value);
         } catch (const exception& e) {
             cerr << "Error parsing key '" << key << "' with value '" << value << "': " << e.what() << endl;
             return false;
@@ -20,6 +20,33 @@ struct Config {
     int port;
     int max_connections;
     int queue_timeout;
+
+    bool delayed_allocation = true;
+    int delalloc_flush_ms = 1000;
+    uint64_t delalloc_max_pending_bytes = 16777216;
+    int append_prealloc_max_blocks = 256;
+    int append_trim_idle_ms = 5000;
+    int inline_max_bytes = 240;
+    int fragment_size = 512;
+    int tail_pack_max_bytes = 2048;
+    uint64_t large_block_size = 262144;
+    int large_region_percent = 25;
+    uint64_t large_file_min_bytes = 1048576;
+    uint64_t block_cache_bytes = 16777216;
+    int readahead_max_blocks = 128;
+    bool write_back = false;
+    uint64_t write_back_max_dirty_bytes = 4194304;
+    int write_back_flush_ms = 1000;
+    uint64_t file_cache_bytes = 4194304;
+    uint64_t file_cache_max_file_bytes = 65536;
+    bool direct_io = false;
+
+    bool defrag_enabled = true;
+    int defrag_blocks_per_step = 64;
+    double defrag_min_fragmentation = 0.0;
+    bool punch_freed_blocks = false;
+    int punch_blocks_per_step = 4096;
+    int maintenance_interval_ms = 50;
 };
 
 bool parse_config(const string& config_path, Config& config);
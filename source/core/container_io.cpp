@@ -0,0 +1,184 @@
+#include "ofs_api.hpp"
+#include "ofs_internal.hpp"
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+// Data blocks are read and written with positioned calls on one descriptor kept
+// open while the container is mounted, so a run of blocks costs one system call
+// and no seek. Vectored calls let one contiguous run on disk fill or drain several
+// buffers. Every call is counted in io_stats.
+//
+// With direct_io, a second descriptor opened with O_DIRECT carries the data so it
+// is not cached twice, once by the block cache and again by the host. Direct I/O
+// needs block-aligned offsets, lengths and memory. Block runs and cache frames
+// already are; other memory goes through a pooled aligned buffer, and reads of
+// partial blocks fetch the whole blocks around them. Writes of partial blocks
+// (packed tails, edits) stay on the buffered descriptor, which the kernel keeps
+// coherent with direct I/O, rather than paying for a read-modify-write.
+
+// Size of each pooled buffer, in blocks, and how many idle ones are kept.
+static const size_t DIRECT_BUFFER_BLOCKS = 64;
+static const size_t DIRECT_POOL_BUFFERS = 4;
+
+// Drops the first done bytes from iov, after a short transfer.
+static void advance_iov(struct iovec*& iov, int& count, size_t done) {
+    while (count > 0 && done >= iov->iov_len) {
+        done -= iov->iov_len;
+        iov++;
+        count--;
+    }
+    if (count > 0) {
+        iov->iov_base = (char*)iov->iov_base + done;
+        iov->iov_len -= done;
+    }
+}
+
+// Copies length bytes between buffer and the front of iov, then drops them from iov.
+static void copy_iov(struct iovec*& iov, int& count, char* buffer, size_t length, bool into_iov) {
+    size_t copied = 0;
+    for (int i = 0; i < count && copied < length; ++i) {
+        size_t piece = min(length - copied, iov[i].iov_len);
+        if (into_iov) memcpy(iov[i].iov_base, buffer + copied, piece);
+        else memcpy(buffer + copied, iov[i].iov_base, piece);
+        copied += piece;
+    }
+    advance_iov(iov, count, length);
+}
+
+static bool transfer(OFSInstance* fs_instance, int fd, bool write, size_t offset, struct iovec* iov, int count) {
+    while (count > 0) {
+        ssize_t done = write ? pwritev(fd, iov, min(count, IOV_MAX), offset) : preadv(fd, iov, min(count, IOV_MAX), offset);
+        if (done < 0 && errno == EINTR) continue;
+        if (done == 0) errno = EIO;
+        if (done <= 0) return false;
+        if (write) {
+            fs_instance->io_stats.write_calls++;
+            fs_instance->io_stats.write_bytes += done;
+        } else {
+            fs_instance->io_stats.read_calls++;
+            fs_instance->io_stats.read_bytes += done;
+        }
+        if (fd == fs_instance->direct_fd) fs_instance->io_stats.direct_calls++;
+        offset += done;
+        advance_iov(iov, count, done);
+    }
+    return true;
+}
+
+void init_direct_io(OFSInstance* fs_instance) {
+    if (!fs_instance->config.direct_io) return;
+    size_t block_size = fs_instance->config.block_size;
+    if (block_size < 512 || (block_size & (block_size - 1)) != 0) {
+        cerr << "fs_init: direct_io needs a power-of-two block_size of at least 512; using buffered I/O." << endl;
+        return;
+    }
+#ifdef O_DIRECT
+    int fd = open(fs_instance->omni_path.c_str(), O_RDWR | O_DIRECT);
+    if (fd < 0) {
+        cerr << "fs_init: " << fs_instance->omni_path << " cannot be opened with O_DIRECT (" << strerror(errno)
+             << "); using buffered I/O." << endl;
+        return;
+    }
+    fs_instance->direct_fd = fd;
+    fs_instance->direct_buffers.initialize(block_size, DIRECT_BUFFER_BLOCKS * block_size, DIRECT_POOL_BUFFERS);
+#else
+    cerr << "fs_init: O_DIRECT is not available on this platform; using buffered I/O." << endl;
+#endif
+}
+
+void close_direct_io(OFSInstance* fs_instance) {
+    if (fs_instance->direct_fd < 0) return;
+    close(fs_instance->direct_fd);
+    fs_instance->direct_fd = -1;
+}
+
+enum class DirectResult { DONE, FAILED, NOT_USED };
+
+// Reads or writes through direct_fd, bouncing through a pool buffer when iov is not
+// aligned. Returns NOT_USED when the request has to go to the buffered descriptor.
+static DirectResult direct_transfer(OFSInstance* fs_instance, bool write, size_t offset, struct iovec* iov, int count) {
+    size_t align = fs_instance->config.block_size;
+    size_t length = 0;
+    bool memory_aligned = true;
+    for (int i = 0; i < count; ++i) {
+        length += iov[i].iov_len;
+        if ((uintptr_t)iov[i].iov_base % align != 0 || iov[i].iov_len % align != 0) memory_aligned = false;
+    }
+    bool range_aligned = offset % align == 0 && length % align == 0;
+    if (write && !range_aligned) return DirectResult::NOT_USED;
+
+    // Worked on a copy, so a rejected request can still be retried buffered.
+    vector<struct iovec> pending(iov, iov + count);
+    struct iovec* rest = pending.data();
+    int rest_count = count;
+    bool ok = true;
+    if (range_aligned && memory_aligned) {
+        ok = transfer(fs_instance, fs_instance->direct_fd, write, offset, rest, rest_count);
+    } else {
+        char* buffer = fs_instance->direct_buffers.acquire();
+        if (buffer == nullptr) return DirectResult::NOT_USED;
+        size_t begin = offset - offset % align;
+        size_t end = (offset + length + align - 1) / align * align;
+        for (size_t pos = begin; ok && pos < end; pos += fs_instance->direct_buffers.bufferSize()) {
+            size_t chunk = min(end - pos, fs_instance->direct_buffers.bufferSize());
+            struct iovec whole = {buffer, chunk};
+            if (write) {
+                copy_iov(rest, rest_count, buffer, chunk, false);
+                ok = transfer(fs_instance, fs_instance->direct_fd, true, pos, &whole, 1);
+            } else if ((ok = transfer(fs_instance, fs_instance->direct_fd, false, pos, &whole, 1))) {
+                size_t from = max(pos, offset);
+                size_t to = min(pos + chunk, offset + length);
+                copy_iov(rest, rest_count, buffer + (from - pos), to - from, true);
+            }
+            if (ok) fs_instance->io_stats.bounced_bytes += chunk;
+        }
+        fs_instance->direct_buffers.release(buffer);
+    }
+    if (ok) return DirectResult::DONE;
+    if (errno != EINVAL) return DirectResult::FAILED;
+
+    // The host accepted O_DIRECT at open but rejects the transfers themselves.
+    cerr << "direct I/O rejected on " << fs_instance->omni_path << "; using buffered I/O." << endl;
+    close_direct_io(fs_instance);
+    return DirectResult::NOT_USED;
+}
+
+bool container_readv(OFSInstance* fs_instance, size_t offset, struct iovec* iov, int count) {
+    if (fs_instance->direct_fd >= 0) {
+        DirectResult result = direct_transfer(fs_instance, false, offset, iov, count);
+        if (result != DirectResult::NOT_USED) return result == DirectResult::DONE;
+    }
+    return transfer(fs_instance, fs_instance->data_fd, false, offset, iov, count);
+}
+
+bool container_writev(OFSInstance* fs_instance, size_t offset, struct iovec* iov, int count) {
+    if (fs_instance->direct_fd >= 0) {
+        DirectResult result = direct_transfer(fs_instance, true, offset, iov, count);
+        if (result != DirectResult::NOT_USED) return result == DirectResult::DONE;
+    }
+    return transfer(fs_instance, fs_instance->data_fd, true, offset, iov, count);
+}
+
+bool container_read(OFSInstance* fs_instance, size_t offset, char* buffer, size_t length) {
+    struct iovec iov = {buffer, length};
+    return length == 0 || container_readv(fs_instance, offset, &iov, 1);
+}
+
+bool container_write(OFSInstance* fs_instance, size_t offset, const char* data, size_t length) {
+    struct iovec iov = {(void*)data, length};
+    return length == 0 || container_writev(fs_instance, offset, &iov, 1);
+}
+
+int get_io_stats(void* instance, IOStats* stats) {
+    OFSInstance* fs_instance = (OFSInstance*)instance;
+    if (fs_instance == nullptr) return (int)OFSErrorCodes::ERROR_INVALID_SESSION;
+    *stats = fs_instance->io_stats;
+    return (int)OFSErrorCodes::SUCCESS;
+}
@@ -0,0 +1,240 @@
+#include "ofs_api.hpp"
+#include "ofs_internal.hpp"
+#include <algorithm>
+
+using namespace std;
+
+// A target claimed by the caller (whole large blocks) is passed as claimed; otherwise
+// the blocks are taken from the main bitmap here.
+static void begin_move(OFSInstance* fs_instance, const string& path, FSTreeNode* node, int64_t target, size_t claimed = 0) {
+    DefragState& st = fs_instance->defrag;
+    st.move_active = true;
+    st.move_path = path;
+    st.move_version = node->version;
+    st.move_source = node->extents;
+    st.move_target = target;
+    st.move_blocks = claimed > 0 ? claimed : st.move_source.blockCount();
+    st.move_copied = 0;
+    if (claimed == 0) fs_instance->bitmap.setBlocks(target, st.move_blocks);
+}
+
+static void abort_move(OFSInstance* fs_instance) {
+    DefragState& st = fs_instance->defrag;
+    free_block_run(fs_instance, st.move_target, st.move_blocks);
+    st.move_active = false;
+    st.move_source.clear();
+    st.moves_aborted++;
+}
+
+static int64_t find_free_run_from_top(const FreeSpaceBitmap& bitmap, size_t num_blocks, size_t lowest) {
+    size_t consecutive_free = 0;
+    for (size_t i = bitmap.size(); i > lowest; --i) {
+        if (bitmap.isBlockSet(i - 1)) {
+            consecutive_free = 0;
+            continue;
+        }
+        if (++consecutive_free == num_blocks) return i - 1;
+    }
+    return -1;
+}
+
+// Picks the next relocation: fragmented files go first, then the lowest free hole
+// is filled with the largest file beyond it that fits. When nothing fits, the file
+// right after the hole is evacuated towards the end so the hole can grow.
+static bool pick_next_move(OFSInstance* fs_instance) {
+    DefragState& st = fs_instance->defrag;
+
+    vector<pair<string, FSTreeNode*>> all_nodes;
+    collect_nodes(fs_instance->fsTree.root, "/", all_nodes);
+
+    // Files in the large-block region are already laid out in whole large blocks.
+    vector<pair<string, FSTreeNode*>> files;
+    for (const auto& item : all_nodes) {
+        if (!item.second->isDirectory() && !item.second->extents.empty() && !is_large_file(fs_instance, item.second)) {
+            files.push_back(item);
+        }
+    }
+
+    // Large files that settled in the small-block region move to large blocks, once
+    // they are no longer being appended to.
+    if (st.large_candidates) {
+        for (const auto& item : files) {
+            FSTreeNode* node = item.second;
+            if (!wants_large_blocks(fs_instance, node->metadata.size) || file_is_sparse(fs_instance, node) ||
+                node->tail.slot_count > 0 || node->has_pending || fs_instance->append_nodes.count(node)) {
+                continue;
+            }
+            size_t claimed = 0;
+            int64_t target = alloc_large_run(fs_instance, node->extents.blockCount(), claimed);
+            if (target == -1) break;
+            begin_move(fs_instance, item.first, node, target, claimed);
+            return true;
+        }
+        st.large_candidates = false;
+    }
+
+    for (const auto& item : files) {
+        if (item.second->extents.isContiguous()) continue;
+        int64_t target = fs_instance->bitmap.findFreeBlocks(item.second->extents.blockCount());
+        if (target != -1) {
+            begin_move(fs_instance, item.first, item.second, target);
+            return true;
+        }
+    }
+
+    size_t total_blocks = fs_instance->bitmap.size();
+    while (true) {
+        size_t hole = st.cursor;
+        while (hole < total_blocks && fs_instance->bitmap.isBlockSet(hole)) hole++;
+        if (hole >= total_blocks) return false;
+
+        size_t run_end = hole;
+        while (run_end < total_blocks && !fs_instance->bitmap.isBlockSet(run_end)) run_end++;
+        size_t run_len = run_end - hole;
+
+        const pair<string, FSTreeNode*>* best = nullptr;
+        for (const auto& item : files) {
+            const ExtentMap& blocks = item.second->extents;
+            if (blocks.firstBlock() < run_end || blocks.blockCount() > run_len) continue;
+            if (!blocks.isContiguous()) continue;
+            if (best == nullptr) { best = &item; continue; }
+
+            const ExtentMap& best_blocks = best->second->extents;
+            if (blocks.blockCount() > best_blocks.blockCount() ||
+                (blocks.blockCount() == best_blocks.blockCount() && blocks.firstBlock() > best_blocks.firstBlock())) {
+                best = &item;
+            }
+        }
+
+        if (best != nullptr) {
+            begin_move(fs_instance, best->first, best->second, hole);
+            return true;
+        }
+
+        for (const auto& item : files) {
+            const ExtentMap& blocks = item.second->extents;
+            if (blocks.firstBlock() != run_end || !blocks.isContiguous()) continue;
+            int64_t target = find_free_run_from_top(fs_instance->bitmap, blocks.blockCount(), run_end + blocks.blockCount());
+            if (target != -1) {
+                begin_move(fs_instance, item.first, item.second, target);
+                return true;
+            }
+        }
+        st.cursor = run_end;
+    }
+}
+
+static bool copy_blocks(OFSInstance* fs_instance, size_t count) {
+    DefragState& st = fs_instance->defrag;
+
+    // Holes are not copied: the source runs are read back to back.
+    ExtentMap packed_source;
+    for (const Extent& extent : st.move_source.list()) packed_source.append(extent.start, extent.length);
+
+    size_t block_size = fs_instance->config.block_size;
+    vector<char> buffer(count * block_size);
+    if (!read_extents(fs_instance, packed_source, st.move_copied * block_size, buffer.data(), buffer.size())) return false;
+    return cached_write(fs_instance, (size_t)(st.move_target + st.move_copied) * block_size, buffer.data(), buffer.size());
+}
+
+// The copy is made durable before the metadata is switched to it, and the old
+// blocks are only released once the new metadata is durable too, so a crash at
+// any point leaves either the old or the new layout intact. If that second sync
+// fails the old blocks are left allocated rather than risk their reuse.
+static bool finish_move(OFSInstance* fs_instance, FSTreeNode* node) {
+    DefragState& st = fs_instance->defrag;
+    size_t count = st.move_source.blockCount();
+
+    // The rest of a claimed large block becomes part of the file, so it must not
+    // expose whatever an earlier file left there.
+    if (st.move_blocks > count) {
+        vector<char> zeroes((st.move_blocks - count) * fs_instance->config.block_size, 0);
+        if (!cached_write(fs_instance, (size_t)(st.move_target + count) * fs_instance->config.block_size, zeroes.data(), zeroes.size())) {
+            abort_move(fs_instance);
+            return false;
+        }
+    }
+    if (!sync_container(fs_instance)) {
+        abort_move(fs_instance);
+        return false;
+    }
+
+    node->extents = st.move_source.relocated(st.move_target);
+    if (st.move_blocks > count) node->extents.append(st.move_target + count, st.move_blocks - count);
+    node->metadata.inode = st.move_target;
+    save_file_system(fs_instance);
+    bool durable = sync_container(fs_instance);
+    if (durable) free_extents(fs_instance, st.move_source.list());
+
+    if (in_large_region(fs_instance, st.move_target)) st.files_promoted++;
+    st.files_moved++;
+    st.blocks_moved += count;
+    st.bytes_moved += count * fs_instance->config.block_size;
+    st.move_active = false;
+    st.move_source.clear();
+    return durable;
+}
+
+int fs_defrag_step(void* instance, size_t block_budget) {
+    OFSInstance* fs_instance = (OFSInstance*)instance;
+    if (fs_instance == nullptr) return (int)OFSErrorCodes::ERROR_INVALID_SESSION;
+    DefragState& st = fs_instance->defrag;
+
+    while (block_budget > 0) {
+        if (!st.move_active) {
+            if (!st.pass_active) {
+                if (fs_instance->bitmap.generation() == st.idle_generation) break;
+                if (!st.fragmented_files && !st.large_candidates &&
+                    fs_instance->bitmap.fragmentation() <= fs_instance->config.defrag_min_fragmentation) {
+                    st.idle_generation = fs_instance->bitmap.generation();
+                    break;
+                }
+                st.pass_active = true;
+                st.cursor = 0;
+            }
+            if (!pick_next_move(fs_instance)) {
+                st.pass_active = false;
+                st.fragmented_files = false;
+                st.passes_completed++;
+                st.idle_generation = fs_instance->bitmap.generation();
+                break;
+            }
+        }
+
+        FSTreeNode* node = find_node_by_path(fs_instance->fsTree.root, st.move_path);
+        if (node == nullptr || node->version != st.move_version || node->extents != st.move_source) {
+            abort_move(fs_instance);
+            continue;
+        }
+
+        size_t chunk = min(block_budget, st.move_source.blockCount() - st.move_copied);
+        if (!copy_blocks(fs_instance, chunk)) {
+            abort_move(fs_instance);
+            return (int)OFSErrorCodes::ERROR_IO_ERROR;
+        }
+        st.move_copied += chunk;
+        block_budget -= chunk;
+
+        if (st.move_copied == st.move_source.blockCount() && !finish_move(fs_instance, node)) {
+            return (int)OFSErrorCodes::ERROR_IO_ERROR;
+        }
+    }
+    return (int)OFSErrorCodes::SUCCESS;
+}
+
+int get_defrag_stats(void* instance, DefragStats* stats) {
+    OFSInstance* fs_instance = (OFSInstance*)instance;
+    if (fs_instance == nullptr) return (int)OFSErrorCodes::ERROR_INVALID_SESSION;
+    const DefragState& st = fs_instance->defrag;
+
+    size_t total_blocks = fs_instance->bitmap.size();
+    stats->running = st.pass_active || st.move_active;
+    stats->progress = (st.pass_active && total_blocks > 0) ? (100.0 * st.cursor / total_blocks) : 0.0;
+    stats->passes_completed = st.passes_completed;
+    stats->files_moved = st.files_moved;
+    stats->blocks_moved = st.blocks_moved;
+    stats->bytes_moved = st.bytes_moved;
+    stats->moves_aborted = st.moves_aborted;
+    stats->files_promoted = st.files_promoted;
+    return (int)OFSErrorCodes::SUCCESS;
+}
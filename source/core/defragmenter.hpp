@@ -0,0 +1,39 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "../data_structures/extent_map.hpp"
+
+struct DefragState {
+    bool pass_active = false;
+    size_t cursor = 0;
+    uint64_t idle_generation = UINT64_MAX;
+    bool fragmented_files = false;
+    bool large_candidates = false;      // Large files may still sit in the small-block region
+
+    bool move_active = false;
+    std::string move_path;
+    uint64_t move_version = 0;
+    ExtentMap move_source;
+    int64_t move_target = -1;
+    size_t move_blocks = 0;             // Blocks claimed at the target; whole large blocks when promoting
+    size_t move_copied = 0;
+
+    uint64_t passes_completed = 0;
+    uint64_t files_moved = 0;
+    uint64_t blocks_moved = 0;
+    uint64_t bytes_moved = 0;
+    uint64_t moves_aborted = 0;
+    uint64_t files_promoted = 0;
+};
+
+struct DefragStats {
+    bool running;
+    double progress;            // Percentage of the current pass scanned (0.0 - 100.0)
+    uint64_t passes_completed;
+    uint64_t files_moved;
+    uint64_t blocks_moved;
+    uint64_t bytes_moved;
+    uint64_t moves_aborted;
+    uint64_t files_promoted;    // Files moved into the large-block region
+};
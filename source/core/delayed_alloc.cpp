@@ -0,0 +1,128 @@
+#include "ofs_api.hpp"
+#include "ofs_internal.hpp"
+#include <chrono>
+
+using namespace std;
+
+uint64_t now_ms() {
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+size_t blocks_for_size(OFSInstance* fs_instance, size_t size) {
+    return (size + fs_instance->config.block_size - 1) / fs_instance->config.block_size;
+}
+
+// Reservations only count blocks; no physical block is chosen until the flush.
+bool reserve_blocks(OFSInstance* fs_instance, FSTreeNode* node, size_t blocks) {
+    size_t others = fs_instance->reserved_blocks - node->reserved_blocks;
+    if (others + blocks > fs_instance->bitmap.freeBlockCount()) return false;
+    fs_instance->reserved_blocks = others + blocks;
+    node->reserved_blocks = blocks;
+    return true;
+}
+
+void buffer_delayed_write(OFSInstance* fs_instance, FSTreeNode* node, const char* data, size_t size) {
+    fs_instance->pending_bytes -= node->pending_data.size();
+    node->pending_data.assign(data, size);
+    fs_instance->pending_bytes += size;
+    if (!node->has_pending) {
+        node->has_pending = true;
+        node->dirty_since_ms = now_ms();
+        fs_instance->pending_nodes.insert(node);
+    }
+}
+
+void release_delayed(OFSInstance* fs_instance, FSTreeNode* node) {
+    fs_instance->reserved_blocks -= node->reserved_blocks;
+    node->reserved_blocks = 0;
+    if (node->has_pending) {
+        fs_instance->pending_bytes -= node->pending_data.size();
+        node->pending_data.clear();
+        node->has_pending = false;
+        fs_instance->pending_nodes.erase(node);
+    }
+}
+
+// Maps the given number of blocks after the node's last one: one run when free
+// space allows it, otherwise the largest free runs in turn. Split files are left to the
+// defragmenter.
+static bool place_blocks(OFSInstance* fs_instance, FSTreeNode* node, size_t blocks) {
+    if (blocks == 0) return true;
+    while (blocks > 0) {
+        size_t run = min(blocks, fs_instance->bitmap.largestFreeExtent());
+        int64_t start = run > 0 ? fs_instance->bitmap.findFreeBlocks(run) : -1;
+        if (start == -1) return false;
+        fs_instance->bitmap.setBlocks(start, run);
+        node->extents.append(start, run);
+        blocks -= run;
+    }
+    node->metadata.inode = node->extents.firstBlock();
+    if (!node->extents.isContiguous()) fs_instance->defrag.fragmented_files = true;
+    return true;
+}
+
+// Places the buffered content now that its final size is known. The data is
+// written before the blocks are linked to the node's record, so until the next
+// save the on-disk metadata still describes the file as empty. On failure the
+// content stays buffered for a later attempt, and the result says whether space
+// or the write ran out.
+int flush_delayed_file(OFSInstance* fs_instance, FSTreeNode* node) {
+    const string& data = node->pending_data;
+    size_t block_size = fs_instance->config.block_size;
+    size_t tail_length = tail_packable(fs_instance, node, data.size()) ? data.size() % block_size : 0;
+    size_t block_bytes = data.size() - tail_length;
+    size_t blocks_needed = blocks_for_size(fs_instance, block_bytes);
+
+    if (!data.empty()) {
+        auto undo = [&](OFSErrorCodes error) {
+            free_extents(fs_instance, node->extents.list());
+            node->extents.clear();
+            return (int)error;
+        };
+        size_t large_run = 0;
+        int64_t large_start = wants_large_blocks(fs_instance, data.size()) ? alloc_large_run(fs_instance, blocks_needed, large_run) : -1;
+        if (large_start != -1) {
+            node->extents.append(large_start, large_run);
+            node->metadata.inode = large_start;
+        } else if (!place_blocks(fs_instance, node, blocks_needed)) {
+            return undo(OFSErrorCodes::ERROR_NO_SPACE);
+        }
+        if (!write_extents(fs_instance, node->extents, 0, data.data(), block_bytes)) return undo(OFSErrorCodes::ERROR_IO_ERROR);
+        if (tail_length > 0 && !write_tail_fragment(fs_instance, node, data.data() + block_bytes, tail_length)) {
+            // No fragment slot left: the tail takes a block of its own instead.
+            if (node->extents.logicalEnd() * block_size < data.size() && !place_blocks(fs_instance, node, 1)) return undo(OFSErrorCodes::ERROR_NO_SPACE);
+            if (!write_extents(fs_instance, node->extents, block_bytes, data.data() + block_bytes, tail_length)) {
+                return undo(OFSErrorCodes::ERROR_IO_ERROR);
+            }
+        }
+    }
+
+    release_delayed(fs_instance, node);
+    note_large_candidate(fs_instance, node);
+    return (int)OFSErrorCodes::SUCCESS;
+}
+
+int fs_flush_delayed(void* instance, bool force) {
+    OFSInstance* fs_instance = (OFSInstance*)instance;
+    if (fs_instance == nullptr) return (int)OFSErrorCodes::ERROR_INVALID_SESSION;
+    if (fs_instance->pending_nodes.empty()) return (int)OFSErrorCodes::SUCCESS;
+
+    bool over_limit = fs_instance->pending_bytes > fs_instance->config.delalloc_max_pending_bytes;
+    uint64_t now = now_ms();
+    int result = (int)OFSErrorCodes::SUCCESS;
+    bool flushed = false;
+
+    vector<FSTreeNode*> nodes(fs_instance->pending_nodes.begin(), fs_instance->pending_nodes.end());
+    for (FSTreeNode* node : nodes) {
+        if (!force && !over_limit && now - node->dirty_since_ms < (uint64_t)fs_instance->config.delalloc_flush_ms) continue;
+        int flush = flush_delayed_file(fs_instance, node);
+        if (flush == (int)OFSErrorCodes::SUCCESS) {
+            flushed = true;
+        } else {
+            result = flush;
+        }
+    }
+
+    if (flushed) save_file_system(fs_instance);
+    return result;
+}
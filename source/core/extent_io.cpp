@@ -0,0 +1,295 @@
+#include "ofs_api.hpp"
+#include "ofs_internal.hpp"
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+
+using namespace std;
+
+// Longest run of missing blocks fetched by one read when the cache is on.
+static const size_t CACHE_READ_RUN_BLOCKS = 256;
+
+// Reads container bytes through the block cache. Missing blocks are read whole, a
+// run of them with one call, and kept for the next reader. Whole blocks of the run
+// land straight in buffer; only partly requested ones go through staging.
+bool cached_read(OFSInstance* fs_instance, size_t disk_offset, char* buffer, size_t length) {
+    BlockCache& cache = fs_instance->block_cache;
+    if (!cache.enabled()) return container_read(fs_instance, disk_offset, buffer, length);
+    if (length == 0) return true;
+
+    size_t block_size = fs_instance->config.block_size;
+    size_t end = disk_offset + length;
+    auto copy_out = [&](size_t block, const char* data) {
+        size_t from = max(disk_offset, block * block_size);
+        size_t to = min(end, (block + 1) * block_size);
+        memcpy(buffer + (from - disk_offset), data + (from - block * block_size), to - from);
+    };
+    auto whole = [&](size_t block) { return block * block_size >= disk_offset && (block + 1) * block_size <= end; };
+    auto in_buffer = [&](size_t block) { return buffer + (block * block_size - disk_offset); };
+
+    // Only the first and last blocks of the request can be partial.
+    vector<char> staging(2 * block_size);
+    struct iovec iov[3];
+    size_t block = disk_offset / block_size;
+    size_t last = (end - 1) / block_size;
+    while (block <= last) {
+        const char* data = cache.find(block);
+        if (data) {
+            copy_out(block, data);
+            block++;
+            continue;
+        }
+        size_t run_end = block + 1;
+        while (run_end <= last && run_end - block < CACHE_READ_RUN_BLOCKS && !cache.contains(run_end)) run_end++;
+
+        int count = 0;
+        size_t staged = 0;
+        for (size_t b = block; b < run_end; ++b) {
+            if (!whole(b)) {
+                iov[count++] = {staging.data() + staged++ * block_size, block_size};
+            } else if (count > 0 && (char*)iov[count - 1].iov_base + iov[count - 1].iov_len == in_buffer(b)) {
+                iov[count - 1].iov_len += block_size;
+            } else {
+                iov[count++] = {in_buffer(b), block_size};
+            }
+        }
+        if (!container_readv(fs_instance, block * block_size, iov, count)) return false;
+
+        staged = 0;
+        for (size_t b = block; b < run_end; ++b) {
+            if (whole(b)) {
+                cache.insert(b, in_buffer(b));
+                continue;
+            }
+            const char* fetched = staging.data() + staged++ * block_size;
+            cache.insert(b, fetched);
+            copy_out(b, fetched);
+        }
+        block = run_end;
+    }
+    return true;
+}
+
+// Reads the blocks covering [disk_offset, disk_offset + length) into the cache ahead
+// of use, one call per run of missing blocks.
+bool cached_prefetch(OFSInstance* fs_instance, size_t disk_offset, size_t length) {
+    BlockCache& cache = fs_instance->block_cache;
+    if (!cache.enabled() || length == 0) return true;
+
+    size_t block_size = fs_instance->config.block_size;
+    size_t last = (disk_offset + length - 1) / block_size;
+    vector<char> staging;
+    size_t block = disk_offset / block_size;
+    while (block <= last) {
+        if (cache.contains(block)) {
+            block++;
+            continue;
+        }
+        size_t run_end = block + 1;
+        while (run_end <= last && run_end - block < CACHE_READ_RUN_BLOCKS && !cache.contains(run_end)) run_end++;
+        staging.resize((run_end - block) * block_size);
+        if (!container_read(fs_instance, block * block_size, staging.data(), staging.size())) return false;
+        for (size_t b = block; b < run_end; ++b) cache.prefetch(b, staging.data() + (b - block) * block_size);
+        block = run_end;
+    }
+    return true;
+}
+
+// Writes through to the container and refreshes any cached copy of the blocks. With
+// write_back, whole blocks and cached blocks are only changed in the cache; a
+// partial write to an uncached block still goes to disk.
+bool cached_write(OFSInstance* fs_instance, size_t disk_offset, const char* data, size_t length) {
+    BlockCache& cache = fs_instance->block_cache;
+    bool write_back = fs_instance->config.write_back && cache.enabled();
+    if (!write_back && !container_write(fs_instance, disk_offset, data, length)) return false;
+    if (!cache.enabled() || length == 0) return true;
+
+    bool was_clean = cache.dirtyBlocks().empty();
+    size_t block_size = fs_instance->config.block_size;
+    size_t end = disk_offset + length;
+    for (size_t block = disk_offset / block_size; block <= (end - 1) / block_size; ++block) {
+        size_t from = max(disk_offset, block * block_size);
+        size_t to = min(end, (block + 1) * block_size);
+        const char* piece = data + (from - disk_offset);
+        if (cache.update(block, from - block * block_size, piece, to - from, write_back) || !write_back) continue;
+        if (to - from == block_size) {
+            cache.insertDirty(block, piece);
+            continue;
+        }
+        if (!container_write(fs_instance, from, piece, to - from)) return false;
+    }
+
+    if (!write_back || cache.dirtyBlocks().empty()) return true;
+    if (was_clean) fs_instance->dirty_since_ms = now_ms();
+    if (cache.dirtyBlocks().size() * block_size > fs_instance->config.write_back_max_dirty_bytes) {
+        return write_back_dirty(fs_instance);
+    }
+    return true;
+}
+
+int get_cache_stats(void* instance, BlockCacheStats* stats) {
+    OFSInstance* fs_instance = (OFSInstance*)instance;
+    if (fs_instance == nullptr) return (int)OFSErrorCodes::ERROR_INVALID_SESSION;
+    *stats = fs_instance->block_cache.stats();
+    stats->written_back_blocks = fs_instance->written_back_blocks;
+    stats->write_back_runs = fs_instance->write_back_runs;
+    return (int)OFSErrorCodes::SUCCESS;
+}
+
+int get_file_cache_stats(void* instance, FileCacheStats* stats) {
+    OFSInstance* fs_instance = (OFSInstance*)instance;
+    if (fs_instance == nullptr) return (int)OFSErrorCodes::ERROR_INVALID_SESSION;
+    *stats = fs_instance->file_cache.stats();
+    return (int)OFSErrorCodes::SUCCESS;
+}
+
+// Walks [offset, offset + length) of a file and calls io once per physical run,
+// so a contiguous file costs one seek regardless of its size. Ranges with no
+// mapping go to hole instead.
+template <typename IoFn, typename HoleFn>
+static bool for_each_run(OFSInstance* fs_instance, const ExtentMap& extents, size_t offset, size_t length, IoFn io, HoleFn hole) {
+    size_t block_size = fs_instance->config.block_size;
+    size_t end = offset + length;
+    size_t pos = offset;
+    size_t index = extents.lowerBound(offset / block_size);
+    while (pos < end) {
+        if (index == extents.extentCount()) return hole(pos - offset, end - pos);
+
+        const Extent& extent = extents.list()[index];
+        size_t extent_begin = extent.logical * block_size;
+        size_t extent_end = (extent.logical + extent.length) * block_size;
+        if (pos < extent_begin) {
+            size_t run = min(end, extent_begin) - pos;
+            if (!hole(pos - offset, run)) return false;
+            pos += run;
+            continue;
+        }
+        size_t run = min(end, extent_end) - pos;
+        if (!io((size_t)extent.start * block_size + (pos - extent_begin), pos - offset, run)) return false;
+        pos += run;
+        index++;
+    }
+    return true;
+}
+
+bool read_extents(OFSInstance* fs_instance, const ExtentMap& extents, size_t offset, char* buffer, size_t length) {
+    return for_each_run(fs_instance, extents, offset, length, [&](size_t disk_offset, size_t done, size_t run) {
+        return cached_read(fs_instance, disk_offset, buffer + done, run);
+    }, [&](size_t done, size_t run) {
+        memset(buffer + done, 0, run);
+        return true;
+    });
+}
+
+bool write_extents(OFSInstance* fs_instance, const ExtentMap& extents, size_t offset, const char* data, size_t length) {
+    return for_each_run(fs_instance, extents, offset, length, [&](size_t disk_offset, size_t done, size_t run) {
+        return cached_write(fs_instance, disk_offset, data + done, run);
+    }, [](size_t, size_t) { return false; });
+}
+
+size_t file_capacity(OFSInstance* fs_instance, FSTreeNode* node) {
+    return node->extents.logicalEnd() * fs_instance->config.block_size + (size_t)node->tail.slot_count * fs_instance->fragment_size;
+}
+
+size_t file_allocated_bytes(OFSInstance* fs_instance, FSTreeNode* node) {
+    return node->extents.blockCount() * fs_instance->config.block_size + (size_t)node->tail.slot_count * fs_instance->fragment_size;
+}
+
+bool file_is_sparse(OFSInstance* fs_instance, FSTreeNode* node) {
+    if (node->is_inline || node->has_pending) return false;
+    return node->extents.hasHoles() || node->metadata.size > file_capacity(fs_instance, node);
+}
+
+// Same walk over a whole file: its extents first, then its packed tail. Anything
+// past the tail is a hole up to the end of file.
+template <typename IoFn, typename HoleFn>
+static bool for_each_file_run(OFSInstance* fs_instance, FSTreeNode* node, size_t offset, size_t length, IoFn io, HoleFn hole) {
+    size_t block_bytes = node->extents.logicalEnd() * fs_instance->config.block_size;
+    size_t capacity = file_capacity(fs_instance, node);
+
+    size_t done = 0;
+    if (offset < block_bytes) {
+        done = min(length, block_bytes - offset);
+        if (!for_each_run(fs_instance, node->extents, offset, done, io, hole)) return false;
+    }
+    if (done < length && offset + done < capacity) {
+        size_t run = min(length - done, capacity - (offset + done));
+        size_t tail_offset = (size_t)node->tail.block * fs_instance->config.block_size +
+                             (size_t)node->tail.first_slot * fs_instance->fragment_size;
+        if (!io(tail_offset + (offset + done - block_bytes), done, run)) return false;
+        done += run;
+    }
+    return done == length || hole(done, length - done);
+}
+
+bool read_file_range(OFSInstance* fs_instance, FSTreeNode* node, size_t offset, char* buffer, size_t length) {
+    return for_each_file_run(fs_instance, node, offset, length, [&](size_t disk_offset, size_t done, size_t run) {
+        return cached_read(fs_instance, disk_offset, buffer + done, run);
+    }, [&](size_t done, size_t run) {
+        memset(buffer + done, 0, run);
+        return true;
+    });
+}
+
+bool prefetch_file_range(OFSInstance* fs_instance, FSTreeNode* node, size_t offset, size_t length) {
+    return for_each_file_run(fs_instance, node, offset, length, [&](size_t disk_offset, size_t, size_t run) {
+        return cached_prefetch(fs_instance, disk_offset, run);
+    }, [](size_t, size_t) { return true; });
+}
+
+bool send_bytes(int out_fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(out_fd, data, length);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+bool send_file_range(int out_fd, OFSInstance* fs_instance, FSTreeNode* node, size_t offset, size_t length) {
+    vector<char> zeroes;
+    return for_each_file_run(fs_instance, node, offset, length, [&](size_t disk_offset, size_t, size_t run) {
+        off_t position = disk_offset;
+        while (run > 0) {
+            ssize_t sent = sendfile(out_fd, fs_instance->data_fd, &position, run);
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent <= 0) return false;
+            fs_instance->io_stats.sendfile_calls++;
+            fs_instance->io_stats.sendfile_bytes += sent;
+            run -= sent;
+        }
+        return true;
+    }, [&](size_t, size_t run) {
+        zeroes.resize(min(run, (size_t)fs_instance->config.block_size * 16));
+        while (run > 0) {
+            size_t chunk = min(run, zeroes.size());
+            if (!send_bytes(out_fd, zeroes.data(), chunk)) return false;
+            run -= chunk;
+        }
+        return true;
+    });
+}
+
+bool write_file_range(OFSInstance* fs_instance, FSTreeNode* node, size_t offset, const char* data, size_t length) {
+    return for_each_file_run(fs_instance, node, offset, length, [&](size_t disk_offset, size_t done, size_t run) {
+        return cached_write(fs_instance, disk_offset, data + done, run);
+    }, [](size_t, size_t) { return false; });
+}
+
+bool zero_file_range(OFSInstance* fs_instance, FSTreeNode* node, size_t offset, size_t length) {
+    vector<char> zeroes(min(length, (size_t)fs_instance->config.block_size * 16), 0);
+    return for_each_file_run(fs_instance, node, offset, length, [&](size_t disk_offset, size_t, size_t run) {
+        while (run > 0) {
+            size_t chunk = min(run, zeroes.size());
+            if (!cached_write(fs_instance, disk_offset, zeroes.data(), chunk)) return false;
+            disk_offset += chunk;
+            run -= chunk;
+        }
+        return true;
+    }, [](size_t, size_t) { return true; });
+}
@@ -14,3 +14,12 @@ Request FifoQueue::pop() {
     q.pop();
     return req;
 }
+
+
+bool FifoQueue::pop_for(Request& req, chrono::milliseconds timeout) {
+    unique_lock<mutex> lock(mtx);
+    if (!cv.wait_for(lock, timeout, [this]{ return !q.empty(); })) return false;
+    req = q.front();
+    q.pop();
+    return true;
+}
\ No newline at end of file
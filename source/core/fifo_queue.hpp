@@ -3,6 +3,7 @@
 #include <string>
 #include <mutex>
 #include <condition_variable>
+#include <chrono>
 #include "../include/json.hpp"
 
 using json = nlohmann::json;
@@ -22,4 +23,5 @@ private:
 public:
     void push(Request req);
     Request pop();
+    bool pop_for(Request& req, chrono::milliseconds timeout);
 };
\ No newline at end of file
@@ -0,0 +1,88 @@
+#include "ofs_api.hpp"
+#include "ofs_internal.hpp"
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+// Freed runs are queued and punched out of the host file by the idle maintenance
+// step, so frees stay cheap and the host reclaims the space shortly after. Blocks
+// allocated again in the meantime are skipped: only blocks still free when their
+// batch runs are punched.
+
+void queue_punch(OFSInstance* fs_instance, size_t start, size_t length) {
+    if (!fs_instance->config.punch_freed_blocks || fs_instance->punch_unsupported || length == 0) return;
+    map<size_t, size_t>& queue = fs_instance->punch_queue;
+    size_t end = start + length;
+    auto it = queue.upper_bound(start);
+    if (it != queue.begin() && prev(it)->first + prev(it)->second >= start) --it;
+    while (it != queue.end() && it->first <= end) {
+        start = min(start, it->first);
+        end = max(end, it->first + it->second);
+        fs_instance->punch_queued_blocks -= it->second;
+        it = queue.erase(it);
+    }
+    queue[start] = end - start;
+    fs_instance->punch_queued_blocks += end - start;
+}
+
+static bool block_is_free(OFSInstance* fs_instance, size_t block) {
+    if (in_large_region(fs_instance, block)) {
+        return !fs_instance->large_bitmap.isBlockSet((block - fs_instance->large_start) / fs_instance->large_unit);
+    }
+    return block < fs_instance->bitmap.size() && !fs_instance->bitmap.isBlockSet(block);
+}
+
+static bool punch_range(OFSInstance* fs_instance, int fd, size_t offset, size_t length) {
+#ifdef FALLOC_FL_PUNCH_HOLE
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length) == 0) return true;
+    if (errno != EOPNOTSUPP && errno != ENOSYS) {
+        cerr << "fs_punch_freed: fallocate failed: " << strerror(errno) << endl;
+        return false;
+    }
+#endif
+    cerr << "fs_punch_freed: hole punching is not supported for " << fs_instance->omni_path << "; disabled." << endl;
+    fs_instance->punch_unsupported = true;
+    fs_instance->punch_queue.clear();
+    fs_instance->punch_queued_blocks = 0;
+    return false;
+}
+
+// Punches up to punch_blocks_per_step queued blocks, or the whole queue when forced.
+int fs_punch_freed(void* instance, bool force) {
+    OFSInstance* fs_instance = (OFSInstance*)instance;
+    if (fs_instance == nullptr) return (int)OFSErrorCodes::ERROR_INVALID_SESSION;
+    if (fs_instance->punch_queue.empty()) return (int)OFSErrorCodes::SUCCESS;
+
+    size_t block_size = fs_instance->config.block_size;
+    size_t budget = force ? SIZE_MAX : (size_t)max(fs_instance->config.punch_blocks_per_step, 1);
+    int result = (int)OFSErrorCodes::SUCCESS;
+    while (!fs_instance->punch_queue.empty() && budget > 0) {
+        auto it = fs_instance->punch_queue.begin();
+        size_t start = it->first;
+        size_t length = min(it->second, budget);
+        if (length < it->second) fs_instance->punch_queue[start + length] = it->second - length;
+        fs_instance->punch_queue.erase(it);
+        fs_instance->punch_queued_blocks -= length;
+        budget -= length;
+
+        size_t block = start;
+        while (block < start + length) {
+            if (!block_is_free(fs_instance, block)) {
+                block++;
+                continue;
+            }
+            size_t run_start = block;
+            while (block < start + length && block_is_free(fs_instance, block)) block++;
+            if (!punch_range(fs_instance, fs_instance->data_fd, run_start * block_size, (block - run_start) * block_size)) {
+                result = (int)OFSErrorCodes::ERROR_IO_ERROR;
+                break;
+            }
+            fs_instance->punched_blocks += block - run_start;
+        }
+        if (result != (int)OFSErrorCodes::SUCCESS) break;
+    }
+    return result;
+}
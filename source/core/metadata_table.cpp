@@ -0,0 +1,96 @@
+#include "ofs_api.hpp"
+#include "ofs_internal.hpp"
+#include <fstream>
+
+using namespace std;
+
+// The metadata table is a sequence of slots: the fixed table laid out at format,
+// then overflow extents allocated from the data area. Every overflow extent holds
+// one RECORD_CHAIN slot naming the next extent, followed by metadata_extent_slots
+// records. Extents are kept once allocated, like the fixed table.
+
+size_t metadata_capacity(OFSInstance* fs_instance) {
+    return fs_instance->metadata_slots + fs_instance->metadata_extents.size() * fs_instance->metadata_extent_slots;
+}
+
+size_t metadata_extent_blocks(OFSInstance* fs_instance) {
+    size_t block_size = fs_instance->config.block_size;
+    return ((fs_instance->metadata_extent_slots + 1) * sizeof(FSTreeNode_Disk) + block_size - 1) / block_size;
+}
+
+size_t metadata_slot_offset(OFSInstance* fs_instance, size_t slot) {
+    if (slot < fs_instance->metadata_slots) return fs_instance->metadata_offset + slot * sizeof(FSTreeNode_Disk);
+    size_t overflow = slot - fs_instance->metadata_slots;
+    size_t extent = fs_instance->metadata_extents[overflow / fs_instance->metadata_extent_slots];
+    return extent * fs_instance->config.block_size + (1 + overflow % fs_instance->metadata_extent_slots) * sizeof(FSTreeNode_Disk);
+}
+
+// True when slot is the first of the fixed table or of an overflow extent, so a
+// sequential reader or writer has to seek to it.
+bool metadata_region_start(OFSInstance* fs_instance, size_t slot) {
+    if (slot < fs_instance->metadata_slots) return slot == 0;
+    return (slot - fs_instance->metadata_slots) % fs_instance->metadata_extent_slots == 0;
+}
+
+// Chains overflow extents until the table has at least slots slots. Blocks promised
+// to buffered writes are left alone.
+bool grow_metadata_table(OFSInstance* fs_instance, size_t slots) {
+    if (fs_instance->metadata_extent_slots == 0) return metadata_capacity(fs_instance) >= slots;
+    size_t blocks = metadata_extent_blocks(fs_instance);
+    while (metadata_capacity(fs_instance) < slots) {
+        if (fs_instance->bitmap.freeBlockCount() < fs_instance->reserved_blocks + blocks) return false;
+        int64_t start = fs_instance->bitmap.findFreeBlocks(blocks);
+        if (start == -1) return false;
+        fs_instance->bitmap.setBlocks(start, blocks);
+        fs_instance->metadata_extents.push_back(start);
+    }
+    return true;
+}
+
+// Rewrites the link slot of every overflow extent, then points the header at the
+// first one. Called after the records themselves have been written.
+void write_metadata_chain(OFSInstance* fs_instance, ostream& omni_file) {
+    const vector<size_t>& extents = fs_instance->metadata_extents;
+    size_t blocks = metadata_extent_blocks(fs_instance);
+    for (size_t i = 0; i < extents.size(); ++i) {
+        FSTreeNode_Disk link = {};
+        link.record_type = FSTreeNode_Disk::RECORD_CHAIN;
+        if (i + 1 < extents.size()) {
+            link.extent_count = 1;
+            link.extents[0] = {extents[i + 1], blocks};
+        }
+        omni_file.seekp(extents[i] * fs_instance->config.block_size);
+        omni_file.write(reinterpret_cast<const char*>(&link), sizeof(FSTreeNode_Disk));
+    }
+
+    size_t chain_start = extents.empty() ? 0 : extents[0];
+    if (chain_start != fs_instance->metadata_chain_saved) {
+        omni_file.flush();
+        if (update_header(fs_instance, [&](OMNIHeader& header) { header.metadata_chain_start = chain_start; })) {
+            fs_instance->metadata_chain_saved = chain_start;
+        }
+    }
+}
+
+// Follows the chain from the header's first extent. A link that does not look like
+// one ends the chain.
+void load_metadata_chain(OFSInstance* fs_instance, istream& omni_file, size_t chain_start) {
+    fs_instance->metadata_extents.clear();
+    fs_instance->metadata_chain_saved = chain_start;
+    if (fs_instance->metadata_extent_slots == 0) return;
+
+    size_t blocks = metadata_extent_blocks(fs_instance);
+    size_t total_blocks = fs_instance->config.total_size / fs_instance->config.block_size;
+    size_t next = chain_start;
+    while (next != 0 && next + blocks <= total_blocks && fs_instance->metadata_extents.size() < total_blocks / blocks) {
+        FSTreeNode_Disk link;
+        omni_file.seekg(next * fs_instance->config.block_size);
+        if (!omni_file.read(reinterpret_cast<char*>(&link), sizeof(FSTreeNode_Disk)) ||
+            link.record_type != FSTreeNode_Disk::RECORD_CHAIN) {
+            cerr << "fs_init: metadata chain broken at block " << next << "." << endl;
+            break;
+        }
+        fs_instance->metadata_extents.push_back(next);
+        next = link.extent_count > 0 && link.extents[0].length == blocks ? link.extents[0].start : 0;
+    }
+}
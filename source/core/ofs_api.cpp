@@ -4,18 +4,80 @@
 #include <cstring>   
 #include <sstream>
 #include <vector>
-#include <cmath>
 #include <stdlib.h>
 #include <time.h>
 #include <functional>
+#include <fcntl.h>
+#include <unistd.h>
 
+#include "ofs_internal.hpp"
 #include "../data_structures/free_space_bitmap.hpp"
 
 using namespace std;
 
-FSTreeNode* find_node_by_path(FSTreeNode* root, const string& path);
-void collect_nodes(FSTreeNode* node, string current_path, vector<pair<string, FSTreeNode*>>& all_nodes);
-void parse_path(const string& path, string& parent_path, string& child_name);
+static vector<FSTreeNode_Disk> make_disk_records(FSTreeNode* node, const string& full_path) {
+    FSTreeNode_Disk record = {};
+    record.entry = node->metadata;
+    strncpy(record.entry.name, full_path.c_str(), sizeof(record.entry.name) - 1);
+    record.record_type = FSTreeNode_Disk::RECORD_NODE;
+    record.prealloc_blocks = node->prealloc_blocks;
+
+    if (node->is_inline) {
+        record.flags |= FSTreeNode_Disk::FLAG_INLINE;
+        memcpy(record.inline_data, node->inline_data.data(), node->inline_data.size());
+        return {record};
+    }
+
+    if (node->tail.slot_count > 0) {
+        record.flags |= FSTreeNode_Disk::FLAG_TAIL;
+        record.tail_block = node->tail.block;
+        record.tail_slot = node->tail.first_slot;
+        record.tail_slots = node->tail.slot_count;
+    }
+
+    // Buffered content is not durable until flushed; until then the file is empty on disk.
+    if (node->has_pending) record.entry.size = 0;
+    if (!node->extents.empty()) record.entry.inode = node->extents.firstBlock();
+
+    vector<FSTreeNode_Disk> records;
+    auto add_entry = [&](size_t start, size_t length) {
+        if (record.extent_count == FSTreeNode_Disk::MAX_EXTENTS) {
+            records.push_back(record);
+            record = {};
+            record.record_type = FSTreeNode_Disk::RECORD_EXTENTS;
+        }
+        record.extents[record.extent_count++] = {start, length};
+    };
+    size_t next_logical = 0;
+    for (const Extent& extent : node->extents.list()) {
+        if (extent.logical > next_logical) add_entry(0, extent.logical - next_logical);
+        add_entry(extent.start, extent.length);
+        next_logical = extent.logical + extent.length;
+    }
+    records.push_back(record);
+    return records;
+}
+
+static void append_extents(FSTreeNode* node, const FSTreeNode_Disk& record, size_t& next_logical) {
+    for (uint32_t e = 0; e < record.extent_count && e < (uint32_t)FSTreeNode_Disk::MAX_EXTENTS; ++e) {
+        const DiskExtent& extent = record.extents[e];
+        if (extent.start != 0) node->extents.insert(next_logical, extent.start, extent.length);
+        next_logical += extent.length;
+    }
+}
+
+void free_extents(OFSInstance* fs_instance, const vector<Extent>& extents) {
+    for (const Extent& extent : extents) free_block_run(fs_instance, extent.start, extent.length);
+}
+
+bool sync_container(OFSInstance* fs_instance) {
+    if (fs_flush_writeback(fs_instance, true) != (int)OFSErrorCodes::SUCCESS) return false;
+    int fd = open(fs_instance->omni_path.c_str(), O_RDWR);
+    if (fd < 0) return false;
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
 
 void save_file_system(OFSInstance* fs_instance) {
     if (!fs_instance) return;
@@ -36,53 +98,64 @@ void save_file_system(OFSInstance* fs_instance) {
         omni_file.write(reinterpret_cast<const char*>(&user), sizeof(UserInfo));
     }
 
-    size_t fs_tree_offset = user_table_offset + (fs_instance->config.max_users * sizeof(UserInfo));
-    
     vector<pair<string, FSTreeNode*>> all_nodes;
     collect_nodes(fs_instance->fsTree.root, "/", all_nodes);
-    
-    FileEntry empty_node = {};
-    omni_file.seekp(fs_tree_offset);
-    for(int i=0; i < fs_instance->config.max_files; ++i) {
-         omni_file.write(reinterpret_cast<const char*>(&empty_node), sizeof(FileEntry));
-    }
 
-    omni_file.seekp(fs_tree_offset);
+    // Records are written slot by slot; a seek is only needed where the table
+    // continues in the next overflow extent.
+    size_t slots_used = 0;
+    auto write_slot = [&](const FSTreeNode_Disk& record) {
+        if (metadata_region_start(fs_instance, slots_used)) {
+            omni_file.seekp(metadata_slot_offset(fs_instance, slots_used));
+        }
+        omni_file.write(reinterpret_cast<const char*>(&record), sizeof(FSTreeNode_Disk));
+        slots_used++;
+    };
     for (const auto& item : all_nodes) {
-        FSTreeNode* node = item.second;
-        string full_path = item.first;
-
-        FileEntry disk_entry = node->metadata;
-        strncpy(disk_entry.name, full_path.c_str(), sizeof(disk_entry.name) - 1);
-        
-        if (!node->data_blocks.empty()) {
-            disk_entry.inode = node->data_blocks[0]; 
+        vector<FSTreeNode_Disk> records = make_disk_records(item.second, item.first);
+        if (!grow_metadata_table(fs_instance, slots_used + records.size())) {
+            cerr << "save_file_system: metadata area full, " << item.first << " not saved." << endl;
+            continue;
         }
-        omni_file.write(reinterpret_cast<const char*>(&disk_entry), sizeof(FileEntry));
+        for (const FSTreeNode_Disk& record : records) write_slot(record);
     }
+    FSTreeNode_Disk empty_node = {};
+    while (slots_used < metadata_capacity(fs_instance)) write_slot(empty_node);
+    write_metadata_chain(fs_instance, omni_file);
 
     size_t total_blocks = fs_instance->bitmap.size();
-    size_t bitmap_size_bytes = (total_blocks + 7) / 8;
-    size_t bitmap_size_aligned = (size_t)ceil((double)bitmap_size_bytes / fs_instance->config.block_size) * fs_instance->config.block_size;
-    size_t bitmap_offset = fs_tree_offset + (fs_instance->config.max_files * sizeof(FileEntry));
+    size_t bitmap_size_aligned = fs_instance->bitmap_size;
+    size_t bitmap_offset = fs_instance->bitmap_offset;
 
     char* bitmap_data = new char[bitmap_size_aligned];
     memset(bitmap_data, 0, bitmap_size_aligned);
     
-    size_t data_blocks_offset = bitmap_offset + bitmap_size_aligned;
-    size_t data_blocks_start = (data_blocks_offset + fs_instance->config.block_size - 1) / fs_instance->config.block_size;
-    
-    for(size_t i = 0; i < data_blocks_start; ++i) {
+    for(size_t i = 0; i < fs_instance->data_start_block; ++i) {
         bitmap_data[i/8] |= (1 << (i%8));
     }
+    for (size_t extent : fs_instance->metadata_extents) {
+        for (size_t i = extent; i < extent + metadata_extent_blocks(fs_instance); ++i) {
+            bitmap_data[i/8] |= (1 << (i%8));
+        }
+    }
+    // After a grow the bitmap lives in the data area and its blocks are in use too.
+    size_t bitmap_first_block = bitmap_offset / fs_instance->config.block_size;
+    if (bitmap_first_block >= fs_instance->data_start_block) {
+        for (size_t i = bitmap_first_block; i < bitmap_first_block + bitmap_size_aligned / fs_instance->config.block_size; ++i) {
+            bitmap_data[i/8] |= (1 << (i%8));
+        }
+    }
     
     for (const auto& item : all_nodes) {
         FSTreeNode* node = item.second;
-        for (int block : node->data_blocks) {
-            if (block < total_blocks) {
+        for (const Extent& extent : node->extents.list()) {
+            for (size_t block = extent.start; block < extent.start + extent.length && block < total_blocks; ++block) {
                 bitmap_data[block/8] |= (1 << (block%8));
             }
         }
+        if (node->tail.slot_count > 0 && node->tail.block < total_blocks) {
+            bitmap_data[node->tail.block/8] |= (1 << (node->tail.block%8));
+        }
     }
 
     omni_file.seekp(bitmap_offset);
@@ -108,18 +181,29 @@ int fs_format(const string& omni_path, const string& config_path) {
 
     OMNIHeader header = {};
     strncpy(header.magic, "OMNIFS01", 8);
+    header.format_version = OFS_FORMAT_VERSION;
     header.total_size = config.total_size;
     header.header_size = sizeof(OMNIHeader);
     header.block_size = config.block_size;
     header.max_users = config.max_users;
 
+    // Tail packing needs at least two slots per block and at most what the fragment allocator tracks.
+    size_t fragment_size = config.fragment_size > 0 ? config.fragment_size : 0;
+    if (fragment_size > 0 && (config.block_size % fragment_size != 0 || config.block_size / fragment_size < 2 ||
+                              config.block_size / fragment_size > FragmentAllocator::MAX_SLOTS_PER_BLOCK)) {
+        cerr << "fs_format: fragment_size " << fragment_size << " does not suit block_size " << config.block_size
+             << "; tail packing disabled." << endl;
+        fragment_size = 0;
+    }
+    header.fragment_size = fragment_size;
+
     size_t total_blocks = config.total_size / config.block_size;
     size_t user_table_size = config.max_users * sizeof(UserInfo);
-    size_t fs_tree_size = config.max_files * sizeof(FileEntry); 
+    size_t fs_tree_size = config.max_files * sizeof(FSTreeNode_Disk); 
     
     size_t bitmap_size_bits = total_blocks;
     size_t bitmap_size_bytes = (bitmap_size_bits + 7) / 8;
-    size_t bitmap_size_aligned = (size_t)ceil((double)bitmap_size_bytes / config.block_size) * config.block_size;
+    size_t bitmap_size_aligned = (bitmap_size_bytes + config.block_size - 1) / config.block_size * config.block_size;
 
     size_t user_table_offset = sizeof(OMNIHeader);
     size_t fs_tree_offset = user_table_offset + user_table_size;
@@ -128,6 +212,26 @@ int fs_format(const string& omni_path, const string& config_path) {
     size_t data_blocks_start_block = (data_blocks_offset + config.block_size - 1) / config.block_size;
 
     header.user_table_offset = user_table_offset;
+    header.bitmap_offset = bitmap_offset;
+    header.bitmap_size = bitmap_size_aligned;
+    header.data_start_block = data_blocks_start_block;
+    header.metadata_slots = config.max_files;
+    header.metadata_extent_slots = config.max_files;
+
+    // The large-block region takes whole large blocks from the end of the data area.
+    size_t large_unit = (config.large_block_size > 0 && config.large_block_size % config.block_size == 0)
+                        ? config.large_block_size / config.block_size : 0;
+    size_t data_blocks = total_blocks > data_blocks_start_block ? total_blocks - data_blocks_start_block : 0;
+    size_t region_percent = (size_t)min(max(config.large_region_percent, 0), 100);
+    if (large_unit >= 2) {
+        size_t units = data_blocks * region_percent / 100 / large_unit;
+        header.large_block_size = units > 0 ? config.large_block_size : 0;
+        header.large_region_blocks = units * large_unit;
+        header.large_region_start = total_blocks - header.large_region_blocks;
+    } else if (config.large_block_size > 0) {
+        cerr << "fs_format: large_block_size " << config.large_block_size << " is not a multiple of block_size "
+             << config.block_size << "; large-block region disabled." << endl;
+    }
     
     omni_file.seekp(0);
     omni_file.write(reinterpret_cast<const char*>(&header), sizeof(OMNIHeader));
@@ -146,13 +250,15 @@ int fs_format(const string& omni_path, const string& config_path) {
     omni_file.seekp(user_table_offset);
     omni_file.write(reinterpret_cast<const char*>(&adminUser), sizeof(UserInfo));
 
-    FileEntry empty_node = {};
-    FileEntry root_node("/", EntryType::DIRECTORY, 0, 0755, "admin", 0, 0);
+    FSTreeNode_Disk empty_node = {};
+    FSTreeNode_Disk root_node = {};
+    root_node.entry = FileEntry("/", EntryType::DIRECTORY, 0, 0755, "admin", 0, 0);
+    root_node.record_type = FSTreeNode_Disk::RECORD_NODE;
     
     omni_file.seekp(fs_tree_offset);
-    omni_file.write(reinterpret_cast<const char*>(&root_node), sizeof(FileEntry));
+    omni_file.write(reinterpret_cast<const char*>(&root_node), sizeof(FSTreeNode_Disk));
     for(int i = 0; i < config.max_files - 1; ++i) {
-        omni_file.write(reinterpret_cast<const char*>(&empty_node), sizeof(FileEntry));
+        omni_file.write(reinterpret_cast<const char*>(&empty_node), sizeof(FSTreeNode_Disk));
     }
 
     char* bitmap_data = new char[bitmap_size_aligned];
@@ -193,10 +299,26 @@ int fs_init(void** instance, const string& omni_path, const string& config_path)
     if (strncmp(header.magic, "OMNIFS01", 8) != 0) {
         return (int)OFSErrorCodes::ERROR_IO_ERROR;
     }
+    if (header.format_version != OFS_FORMAT_VERSION) {
+        cerr << "fs_init: Unsupported format version " << hex << header.format_version << dec
+             << " in " << omni_path << "; reformat the container." << endl;
+        return (int)OFSErrorCodes::ERROR_IO_ERROR;
+    }
     
+    // The container may have grown since it was formatted; its header has the current size.
+    config.total_size = header.total_size;
+
     OFSInstance* fs_instance = new OFSInstance();
     fs_instance->config = config;
     fs_instance->omni_path = omni_path;
+    fs_instance->bitmap_offset = header.bitmap_offset;
+    fs_instance->bitmap_size = header.bitmap_size;
+    fs_instance->data_start_block = header.data_start_block;
+    fs_instance->metadata_offset = header.user_table_offset + header.max_users * sizeof(UserInfo);
+    fs_instance->metadata_slots = header.metadata_slots;
+    fs_instance->metadata_extent_slots = header.metadata_extent_slots;
+    fs_instance->fragment_size = header.fragment_size;
+    fs_instance->fragments.initialize(header.fragment_size ? config.block_size / header.fragment_size : 0);
 
     omni_file.seekg(header.user_table_offset);
     for(int i = 0; i < header.max_users; ++i) {
@@ -207,14 +329,27 @@ int fs_init(void** instance, const string& omni_path, const string& config_path)
         }
     }
 
-    size_t fs_tree_offset = header.user_table_offset + (header.max_users * sizeof(UserInfo));
-    omni_file.seekg(fs_tree_offset);
-    
-    for(int i = 0; i < config.max_files; ++i) {
-        FileEntry entry;
-        omni_file.read(reinterpret_cast<char*>(&entry), sizeof(FileEntry));
-        
-        if (entry.name[0] == '\0') continue;
+    load_metadata_chain(fs_instance, omni_file, header.metadata_chain_start);
+
+    FSTreeNode* last_file = nullptr;
+    size_t next_logical = 0;
+    size_t slot_count = metadata_capacity(fs_instance);
+    for(size_t i = 0; i < slot_count; ++i) {
+        if (metadata_region_start(fs_instance, i)) {
+            omni_file.seekg(metadata_slot_offset(fs_instance, i));
+        }
+        FSTreeNode_Disk record;
+        omni_file.read(reinterpret_cast<char*>(&record), sizeof(FSTreeNode_Disk));
+
+        if (record.record_type == FSTreeNode_Disk::RECORD_EXTENTS) {
+            if (last_file) append_extents(last_file, record, next_logical);
+            fs_instance->defrag.fragmented_files = true;
+            continue;
+        }
+        last_file = nullptr;
+
+        FileEntry& entry = record.entry;
+        if (record.record_type != FSTreeNode_Disk::RECORD_NODE || entry.name[0] == '\0') continue;
 
         string full_path = entry.name;
         if (full_path == "/") continue; 
@@ -228,37 +363,51 @@ int fs_init(void** instance, const string& omni_path, const string& config_path)
             
             FSTreeNode* new_node = new FSTreeNode(entry, parent);
             
-            if (entry.getType() == EntryType::FILE && entry.size > 0) {
-                int start_block = entry.inode; 
-                size_t blocks_needed = (entry.size + config.block_size - 1) / config.block_size;
-                for(size_t b = 0; b < blocks_needed; ++b) {
-                    new_node->data_blocks.push_back(start_block + b);
+            if (entry.getType() == EntryType::FILE && (record.flags & FSTreeNode_Disk::FLAG_INLINE)) {
+                new_node->is_inline = true;
+                new_node->inline_data.assign(record.inline_data, min((size_t)entry.size, (size_t)FSTreeNode_Disk::INLINE_CAPACITY));
+            } else if (entry.getType() == EntryType::FILE) {
+                next_logical = 0;
+                append_extents(new_node, record, next_logical);
+                new_node->prealloc_blocks = record.prealloc_blocks;
+                if ((record.flags & FSTreeNode_Disk::FLAG_TAIL) && record.tail_slots > 0) {
+                    new_node->tail = {record.tail_block, record.tail_slot, record.tail_slots};
+                    fs_instance->fragments.mark(new_node->tail);
                 }
+                if (!new_node->extents.isContiguous()) fs_instance->defrag.fragmented_files = true;
+                last_file = new_node;
             }
             parent->addChild(new_node);
         }
     }
     
     size_t total_blocks = config.total_size / config.block_size;
-    size_t bitmap_size_bytes = (total_blocks + 7) / 8;
-    size_t bitmap_size_aligned = (size_t)ceil((double)bitmap_size_bytes / config.block_size) * config.block_size;
-    size_t bitmap_offset = fs_tree_offset + (config.max_files * sizeof(FileEntry));
-
-    char* bitmap_data = new char[bitmap_size_aligned];
-    omni_file.seekg(bitmap_offset);
-    omni_file.read(bitmap_data, bitmap_size_aligned);
+    char* bitmap_data = new char[header.bitmap_size];
+    omni_file.seekg(header.bitmap_offset);
+    omni_file.read(bitmap_data, header.bitmap_size);
 
     fs_instance->bitmap.initialize(total_blocks);
-    for(size_t i = 0; i < total_blocks; ++i) {
-        size_t byte_index = i / 8;
-        int bit_index = i % 8;
-        if ((bitmap_data[byte_index] >> bit_index) & 1) {
-            fs_instance->bitmap.setBlock(i);
-        }
+    size_t used_run_start = 0;
+    bool in_used_run = false;
+    for(size_t i = 0; i <= total_blocks; ++i) {
+        bool used = i < total_blocks && ((bitmap_data[i / 8] >> (i % 8)) & 1);
+        if (used && !in_used_run) used_run_start = i;
+        if (!used && in_used_run) fs_instance->bitmap.setBlocks(used_run_start, i - used_run_start);
+        in_used_run = used;
     }
     delete[] bitmap_data;
+    init_block_classes(fs_instance, header.large_block_size, header.large_region_start, header.large_region_blocks);
+    fs_instance->block_cache.initialize(config.block_size, config.block_cache_bytes / config.block_size);
+    init_write_back(fs_instance);
+    fs_instance->file_cache.initialize(config.file_cache_bytes, config.file_cache_max_file_bytes);
     
     omni_file.close();
+    fs_instance->data_fd = open(omni_path.c_str(), O_RDWR);
+    if (fs_instance->data_fd < 0) {
+        delete fs_instance;
+        return (int)OFSErrorCodes::ERROR_IO_ERROR;
+    }
+    init_direct_io(fs_instance);
 
     *instance = (void*)fs_instance;
     cout << "fs_init: Successfully loaded instance from " << omni_path << endl;
@@ -268,11 +417,81 @@ int fs_init(void** instance, const string& omni_path, const string& config_path)
 void fs_shutdown(void* instance) {
     if (instance == nullptr) return;
     OFSInstance* fs_instance = (OFSInstance*)instance;
+    if (fs_flush_delayed(fs_instance, true) != (int)OFSErrorCodes::SUCCESS) {
+        for (FSTreeNode* node : fs_instance->pending_nodes) {
+            cerr << "fs_shutdown: could not place " << node->pending_data.size() << " buffered bytes of " << node->metadata.name << "." << endl;
+        }
+    }
+    fs_trim_appends(fs_instance, true);
+    fs_flush_writeback(fs_instance, true);
     save_file_system(fs_instance);
+    fs_punch_freed(fs_instance, true);
+    close_direct_io(fs_instance);
+    close(fs_instance->data_fd);
     delete fs_instance;
     cout << "fs_shutdown: Successfully saved and shut down." << endl;
 }
 
+// Rewrites the header in place; it is otherwise only written by fs_format.
+bool update_header(OFSInstance* fs_instance, const function<void(OMNIHeader&)>& change) {
+    fstream omni_file(fs_instance->omni_path, ios::binary | ios::in | ios::out);
+    OMNIHeader header;
+    if (!omni_file.read(reinterpret_cast<char*>(&header), sizeof(OMNIHeader))) return false;
+    change(header);
+    omni_file.seekp(0);
+    omni_file.write(reinterpret_cast<const char*>(&header), sizeof(OMNIHeader));
+    omni_file.close();
+    return !omni_file.fail();
+}
+
+// Extends the container to new_size bytes while it is in use; the new blocks can be
+// allocated at once. When the bitmap outgrows its region it moves to the start of the
+// new space. The header is rewritten last, so a crash before it leaves the old size.
+int fs_grow(void* instance, uint64_t new_size) {
+    OFSInstance* fs_instance = (OFSInstance*)instance;
+    if (fs_instance == nullptr) return (int)OFSErrorCodes::ERROR_INVALID_SESSION;
+
+    size_t block_size = fs_instance->config.block_size;
+    size_t old_blocks = fs_instance->bitmap.size();
+    size_t new_blocks = new_size / block_size;
+    if (new_blocks <= old_blocks) return (int)OFSErrorCodes::ERROR_INVALID_OPERATION;
+
+    size_t bitmap_offset = fs_instance->bitmap_offset;
+    size_t bitmap_size = fs_instance->bitmap_size;
+    if ((new_blocks + 7) / 8 > bitmap_size) {
+        bitmap_size = ((new_blocks + 7) / 8 + block_size - 1) / block_size * block_size;
+        if (bitmap_size / block_size >= new_blocks - old_blocks) return (int)OFSErrorCodes::ERROR_NO_SPACE;
+        bitmap_offset = old_blocks * block_size;
+    }
+    if (truncate(fs_instance->omni_path.c_str(), new_size) != 0) return (int)OFSErrorCodes::ERROR_IO_ERROR;
+
+    fs_instance->bitmap.grow(new_blocks);
+    if (bitmap_offset != fs_instance->bitmap_offset) {
+        // A region left by an earlier grow is ordinary data space again.
+        size_t old_first = fs_instance->bitmap_offset / block_size;
+        if (old_first >= fs_instance->data_start_block) {
+            fs_instance->bitmap.freeBlocks(old_first, fs_instance->bitmap_size / block_size);
+            queue_punch(fs_instance, old_first, fs_instance->bitmap_size / block_size);
+        }
+        fs_instance->bitmap.setBlocks(bitmap_offset / block_size, bitmap_size / block_size);
+    }
+    fs_instance->config.total_size = new_size;
+    fs_instance->bitmap_offset = bitmap_offset;
+    fs_instance->bitmap_size = bitmap_size;
+    save_file_system(fs_instance);
+    if (!sync_container(fs_instance)) return (int)OFSErrorCodes::ERROR_IO_ERROR;
+
+    bool updated = update_header(fs_instance, [&](OMNIHeader& header) {
+        header.total_size = new_size;
+        header.bitmap_offset = bitmap_offset;
+        header.bitmap_size = bitmap_size;
+    });
+    if (!updated || !sync_container(fs_instance)) return (int)OFSErrorCodes::ERROR_IO_ERROR;
+
+    cout << "fs_grow: " << fs_instance->omni_path << " grown to " << new_size << " bytes." << endl;
+    return (int)OFSErrorCodes::SUCCESS;
+}
+
 FSTreeNode* find_node_by_path(FSTreeNode* root, const string& path) {
     if (path == "/" || path == "") return root;
 
@@ -419,7 +638,7 @@ int dir_create(void* instance, const char* path) {
     if (parent == nullptr || !parent->isDirectory()) return (int)OFSErrorCodes::ERROR_NOT_FOUND; 
     if (parent->findChild(name) != nullptr) return (int)OFSErrorCodes::ERROR_FILE_EXISTS;
 
-    uint32_t parent_inode_dir = parent->metadata.inode;
+    uint64_t parent_inode_dir = parent->metadata.inode;
     FileEntry meta(name, EntryType::DIRECTORY, 0, 0755, "admin", 0, parent_inode_dir);
     FSTreeNode* new_dir = new FSTreeNode(meta, parent);
     parent->addChild(new_dir);
@@ -480,6 +699,49 @@ int dir_exists(void* instance, const char* path) {
     return (int)OFSErrorCodes::ERROR_NOT_FOUND;
 }
 
+static bool fits_inline(OFSInstance* fs_instance, size_t size) {
+    size_t limit = min((size_t)max(fs_instance->config.inline_max_bytes, 0), (size_t)FSTreeNode_Disk::INLINE_CAPACITY);
+    return limit > 0 && size <= limit;
+}
+
+// Keeps the whole content in the file's metadata record. Any blocks, buffered
+// data or reservation the file held are given up.
+static int store_inline(OFSInstance* fs_instance, FSTreeNode* node, const char* data, size_t size) {
+    release_delayed(fs_instance, node);
+    fs_instance->append_nodes.erase(node);
+    drop_tail(fs_instance, node);
+    vector<Extent> freed = node->extents.list();
+    node->extents.clear();
+
+    node->is_inline = true;
+    node->inline_data.assign(data, size);
+    node->metadata.size = size;
+    node->version = ++fs_instance->next_version;
+
+    save_file_system(fs_instance);
+    free_extents(fs_instance, freed);
+    return (int)OFSErrorCodes::SUCCESS;
+}
+
+// An inline file that outgrows its record continues as an unplaced file whose
+// content is buffered, so the block-based write paths take it from there.
+static void promote_inline(OFSInstance* fs_instance, FSTreeNode* node) {
+    if (!node->is_inline) return;
+    node->is_inline = false;
+    buffer_delayed_write(fs_instance, node, node->inline_data.data(), node->inline_data.size());
+    node->inline_data.clear();
+}
+
+// True while the file's content is held in memory (inline or buffered) or it has
+// none yet. A file with a size but no storage is all hole, and is extended or cut
+// through the sparse paths instead.
+static bool is_unplaced(FSTreeNode* node) {
+    if (!node->extents.empty() || node->tail.slot_count > 0) return false;
+    return node->is_inline || node->has_pending || node->metadata.size == 0;
+}
+
+// With data, creates the file with that content. Without it, size is only a hint:
+// the file starts empty and size bytes are reserved for its first write.
 int file_create(void* instance, const char* path, const char* data, size_t size) {
     OFSInstance* fs_instance = (OFSInstance*)instance;
     if (fs_instance == nullptr) return (int)OFSErrorCodes::ERROR_INVALID_SESSION;
@@ -491,38 +753,69 @@ int file_create(void* instance, const char* path, const char* data, size_t size)
     if (parent == nullptr || !parent->isDirectory()) return (int)OFSErrorCodes::ERROR_NOT_FOUND; 
     if (parent->findChild(name) != nullptr) return (int)OFSErrorCodes::ERROR_FILE_EXISTS;
 
-    size_t blocks_needed = (size == 0) ? 1 : (size + fs_instance->config.block_size - 1) / fs_instance->config.block_size;
-    int start_block = fs_instance->bitmap.findFreeBlocks(blocks_needed);
-    if (start_block == -1) return (int)OFSErrorCodes::ERROR_NO_SPACE;
+    uint64_t parent_inode_file = parent->metadata.inode;
+    if (fits_inline(fs_instance, size)) {
+        FileEntry meta(name, EntryType::FILE, 0, 0644, "admin", 0, parent_inode_file);
+        FSTreeNode* new_file = new FSTreeNode(meta, parent);
+        parent->addChild(new_file);
+        return store_inline(fs_instance, new_file, data ? data : "", data ? size : 0);
+    }
+    if (data == nullptr) {
+        FileEntry meta(name, EntryType::FILE, 0, 0644, "admin", 0, parent_inode_file);
+        FSTreeNode* new_file = new FSTreeNode(meta, parent);
+        if (!reserve_blocks(fs_instance, new_file, blocks_for_size(fs_instance, size))) {
+            delete new_file;
+            return (int)OFSErrorCodes::ERROR_NO_SPACE;
+        }
+        new_file->version = ++fs_instance->next_version;
+        parent->addChild(new_file);
 
-    fs_instance->bitmap.setBlocks(start_block, blocks_needed);
+        save_file_system(fs_instance);
+        return (int)OFSErrorCodes::SUCCESS;
+    }
 
-    uint32_t parent_inode_file = parent->metadata.inode;
-    FileEntry meta(name, EntryType::FILE, size, 0644, "admin", start_block, parent_inode_file); 
-    meta.inode = start_block; 
-    FSTreeNode* new_file = new FSTreeNode(meta, parent);
+    size_t blocks_needed = (size == 0) ? 1 : (size + fs_instance->config.block_size - 1) / fs_instance->config.block_size;
+    // Large files go straight to the large-block region while it has room.
+    size_t large_run = 0;
+    int64_t large_start = wants_large_blocks(fs_instance, size) ? alloc_large_run(fs_instance, blocks_needed, large_run) : -1;
+    if (large_start == -1 && fs_instance->bitmap.freeBlockCount() < fs_instance->reserved_blocks + blocks_needed) {
+        return (int)OFSErrorCodes::ERROR_NO_SPACE;
+    }
 
-    for (size_t i = 0; i < blocks_needed; ++i) new_file->data_blocks.push_back(start_block + i);
-    parent->addChild(new_file);
+    FileEntry meta(name, EntryType::FILE, size, 0644, "admin", 0, parent_inode_file); 
+    FSTreeNode* new_file = new FSTreeNode(meta, parent);
 
-    if (data != nullptr && size > 0) {
-        const char* data_ptr = data;
-        size_t bytes_left = size;
-
-        fstream omni_file(fs_instance->omni_path, ios::binary | ios::in | ios::out);
-        if (omni_file) {
-            for (int block : new_file->data_blocks) {
-                if (bytes_left == 0) break;
-                size_t offset = (size_t)block * fs_instance->config.block_size;
-                omni_file.seekp(offset);
-                size_t to_write = min(bytes_left, (size_t)fs_instance->config.block_size);
-                omni_file.write(data_ptr, to_write);
-                data_ptr += to_write;
-                bytes_left -= to_write;
-            }
-            omni_file.close();
+    // The last partial block goes to a shared fragment when it is small enough.
+    size_t tail_length = tail_packable(fs_instance, new_file, size) ? size % fs_instance->config.block_size : 0;
+    if (tail_length > 0) blocks_needed = blocks_for_size(fs_instance, size - tail_length);
+
+    if (large_start != -1) {
+        new_file->extents.append(large_start, large_run);
+        new_file->metadata.inode = large_start;
+    } else if (blocks_needed > 0) {
+        int64_t start_block = fs_instance->bitmap.findFreeBlocks(blocks_needed);
+        if (start_block == -1) {
+            delete new_file;
+            return (int)OFSErrorCodes::ERROR_NO_SPACE;
         }
+        fs_instance->bitmap.setBlocks(start_block, blocks_needed);
+        new_file->extents.append(start_block, blocks_needed);
+        new_file->metadata.inode = start_block;
+    }
+
+    int result = (int)OFSErrorCodes::SUCCESS;
+    if (!write_extents(fs_instance, new_file->extents, 0, data, size - tail_length)) {
+        result = (int)OFSErrorCodes::ERROR_IO_ERROR;
+    } else if (tail_length > 0 && !write_tail_fragment(fs_instance, new_file, data + size - tail_length, tail_length)) {
+        result = (int)OFSErrorCodes::ERROR_NO_SPACE;
     }
+    if (result != (int)OFSErrorCodes::SUCCESS) {
+        free_extents(fs_instance, new_file->extents.list());
+        delete new_file;
+        return result;
+    }
+    new_file->version = ++fs_instance->next_version;
+    parent->addChild(new_file);
     
     save_file_system(fs_instance);
     return (int)OFSErrorCodes::SUCCESS;
@@ -542,7 +835,11 @@ int file_delete(void* instance, const char* path) {
     if (node == nullptr) return (int)OFSErrorCodes::ERROR_NOT_FOUND;
     if (node->isDirectory()) return (int)OFSErrorCodes::ERROR_INVALID_OPERATION;
 
-    for (int block : node->data_blocks) fs_instance->bitmap.freeBlock(block);
+    free_extents(fs_instance, node->extents.list());
+    drop_tail(fs_instance, node);
+    release_delayed(fs_instance, node);
+    fs_instance->append_nodes.erase(node);
+    fs_instance->file_cache.erase(node);
     parent->removeChild(name);
     delete node;
     
@@ -570,65 +867,530 @@ int file_read(void* instance, const char* path, char** buffer, size_t* size) {
 
     *buffer = new char[*size + 1]; 
     memset(*buffer, 0, *size + 1);
-    char* data_ptr = *buffer;
-    size_t bytes_left = *size;
-    ifstream omni_file(fs_instance->omni_path, ios::binary);
-    if (!omni_file) { delete[] *buffer; return (int)OFSErrorCodes::ERROR_IO_ERROR; }
-
-    for (int block : node->data_blocks) {
-        if (bytes_left == 0) break;
-        size_t offset = (size_t)block * fs_instance->config.block_size;
-        omni_file.seekg(offset);
-        size_t to_read = min(bytes_left, (size_t)fs_instance->config.block_size);
-        omni_file.read(data_ptr, to_read);
-        data_ptr += to_read;
-        bytes_left -= to_read;
+    if (node->is_inline) {
+        memcpy(*buffer, node->inline_data.data(), *size);
+        return (int)OFSErrorCodes::SUCCESS;
     }
-    omni_file.close();
+    if (node->has_pending) {
+        memcpy(*buffer, node->pending_data.data(), *size);
+        return (int)OFSErrorCodes::SUCCESS;
+    }
+
+    bool cacheable = fs_instance->file_cache.eligible(*size);
+    const string* cached = cacheable ? fs_instance->file_cache.find(node, node->version) : nullptr;
+    if (cached) {
+        memcpy(*buffer, cached->data(), *size);
+        return (int)OFSErrorCodes::SUCCESS;
+    }
+
+    if (!read_file_range(fs_instance, node, 0, *buffer, *size)) {
+        delete[] *buffer;
+        return (int)OFSErrorCodes::ERROR_IO_ERROR;
+    }
+    if (cacheable) fs_instance->file_cache.insert(node, node->version, *buffer, *size);
     return (int)OFSErrorCodes::SUCCESS;
 }
 
-int file_edit(void* instance, const char* path, const char* data, size_t size, uint32_t index) {
+// Writes [offset, offset + length) of a file to out_fd, normally a client socket.
+// Bytes in the container go out with sendfile and never pass through user space;
+// holes and in-memory content (inline or buffered files) are written directly.
+int file_send(void* instance, const char* path, uint64_t offset, uint64_t length, int out_fd) {
     OFSInstance* fs_instance = (OFSInstance*)instance;
     if (fs_instance == nullptr) return (int)OFSErrorCodes::ERROR_INVALID_SESSION;
 
     FSTreeNode* node = find_node_by_path(fs_instance->fsTree.root, path);
     if (node == nullptr || node->isDirectory()) return (int)OFSErrorCodes::ERROR_NOT_FOUND;
-    if (index != 0) return (int)OFSErrorCodes::ERROR_NOT_IMPLEMENTED;
-    
-    if (size > (node->data_blocks.size() * fs_instance->config.block_size)) return (int)OFSErrorCodes::ERROR_NO_SPACE;
 
-    const char* data_ptr = data;
-    size_t bytes_left = size;
+    size_t file_size = node->metadata.size;
+    size_t size = offset < file_size ? (size_t)min<uint64_t>(length, file_size - offset) : 0;
+    if (size == 0) return (int)OFSErrorCodes::SUCCESS;
 
-    fstream omni_file(fs_instance->omni_path, ios::binary | ios::in | ios::out);
-    if (!omni_file) return (int)OFSErrorCodes::ERROR_IO_ERROR;
+    bool ok;
+    if (node->is_inline) {
+        ok = send_bytes(out_fd, node->inline_data.data() + offset, size);
+    } else if (node->has_pending) {
+        ok = send_bytes(out_fd, node->pending_data.data() + offset, size);
+    } else {
+        if (fs_flush_writeback(instance, true) != (int)OFSErrorCodes::SUCCESS) return (int)OFSErrorCodes::ERROR_IO_ERROR;
+        ok = send_file_range(out_fd, fs_instance, node, offset, size);
+    }
+    return ok ? (int)OFSErrorCodes::SUCCESS : (int)OFSErrorCodes::ERROR_IO_ERROR;
+}
 
-    for (int block : node->data_blocks) {
-        if (bytes_left == 0) break;
-        size_t offset = (size_t)block * fs_instance->config.block_size;
-        omni_file.seekp(offset);
-        size_t to_write = min(bytes_left, (size_t)fs_instance->config.block_size);
-        omni_file.write(data_ptr, to_write);
-        data_ptr += to_write;
-        bytes_left -= to_write;
+// Extends the file's last extent with up to max_blocks free blocks that directly follow it.
+static size_t claim_tail_blocks(OFSInstance* fs_instance, FSTreeNode* node, size_t max_blocks) {
+    if (node->extents.empty()) return 0;
+    size_t next_block = node->extents.endBlock();
+    size_t claimed = 0;
+    while (claimed < max_blocks && next_block + claimed < fs_instance->bitmap.size() &&
+           !fs_instance->bitmap.isBlockSet(next_block + claimed)) {
+        claimed++;
     }
-    omni_file.close();
+    if (claimed == 0) return 0;
+
+    fs_instance->bitmap.setBlocks(next_block, claimed);
+    node->extents.append(next_block, claimed);
+    return claimed;
+}
+
+// Backs every unmapped block in [first, first + count) with storage, continuing
+// the physical run of the block before it where the following blocks are free and
+// taking further runs otherwise. Files in the large-block region are mapped in
+// whole large blocks, falling back to small blocks when the region is full. Files
+// left split are picked up by the defragmenter on its next pass. On failure the
+// map is left as it was. The newly mapped runs are added to mapped, since they
+// hold stale data until written.
+static bool map_blocks(OFSInstance* fs_instance, FSTreeNode* node, size_t first, size_t count, vector<Extent>* mapped = nullptr) {
+    bool large = is_large_file(fs_instance, node);
+    size_t unit = large ? fs_instance->large_unit : 1;
+    size_t begin = first / unit * unit;
+    vector<Extent> holes = node->extents.holes(begin, class_blocks(fs_instance, node, first + count) - begin);
+    size_t needed = 0;
+    for (const Extent& hole : holes) needed += hole.length;
+    if (needed == 0) return true;
+
+    size_t reserved_by_others = fs_instance->reserved_blocks - node->reserved_blocks;
+    size_t available = fs_instance->bitmap.freeBlockCount() + (large ? large_free_blocks(fs_instance) : 0);
+    if (available < reserved_by_others + needed) return false;
+
+    vector<Extent> added;
+    for (const Extent& hole : holes) {
+        size_t logical = hole.logical;
+        size_t remaining = hole.length;
+        bool small_blocks = !large;
+        while (remaining > 0) {
+            int64_t start = -1;
+            size_t run = 0;
+            int64_t previous = logical > 0 ? node->extents.physicalBlock(logical - 1) : -1;
+            if (!small_blocks) {
+                if (previous >= 0) {
+                    run = claim_large_after(fs_instance, previous + 1, remaining);
+                    start = previous + 1;
+                }
+                if (run == 0) start = alloc_large_run(fs_instance, remaining, run, true);
+                // Once small blocks are used, the rest of the hole stays small so the
+                // large blocks keep lining up with whole units of the file.
+                if (start == -1) small_blocks = true;
+            }
+            if (small_blocks) {
+                run = 0;
+                if (previous >= 0) {
+                    while (run < remaining && (size_t)previous + 1 + run < fs_instance->bitmap.size() &&
+                           !fs_instance->bitmap.isBlockSet(previous + 1 + run)) {
+                        run++;
+                    }
+                    start = previous + 1;
+                }
+                if (run == 0) {
+                    run = min(remaining, fs_instance->bitmap.largestFreeExtent());
+                    start = run > 0 ? fs_instance->bitmap.findFreeBlocks(run) : -1;
+                }
+                if (start == -1) {
+                    for (const Extent& extent : added) free_extents(fs_instance, node->extents.punch(extent.logical, extent.length));
+                    return false;
+                }
+                fs_instance->bitmap.setBlocks(start, run);
+            }
+
+            node->extents.insert(logical, start, run);
+            added.push_back({logical, (size_t)start, run});
+            logical += run;
+            remaining -= run;
+        }
+    }
+
+    node->metadata.inode = node->extents.firstBlock();
+    if (!node->extents.isContiguous()) fs_instance->defrag.fragmented_files = true;
+    if (mapped) mapped->insert(mapped->end(), added.begin(), added.end());
+    return true;
+}
+
+// Stores the complete new content of a file that has no blocks yet. The content
+// stays buffered under delayed allocation and is placed right away otherwise; a
+// failed placement leaves the file with its previous content.
+static int write_unplaced_content(OFSInstance* fs_instance, FSTreeNode* node, const char* data, size_t size) {
+    bool was_inline = node->is_inline;
+    bool had_pending = node->has_pending;
+    string old_content = was_inline ? node->inline_data : node->pending_data;
+    size_t old_size = node->metadata.size;
+    size_t old_reserved = node->reserved_blocks;
+    FragmentRef old_tail = node->tail;
+
+    if (!reserve_blocks(fs_instance, node, blocks_for_size(fs_instance, size))) return (int)OFSErrorCodes::ERROR_NO_SPACE;
+    node->tail = {0, 0, 0};
+    node->is_inline = false;
+    node->inline_data.clear();
+    buffer_delayed_write(fs_instance, node, data, size);
     node->metadata.size = size;
-    
+    node->version = ++fs_instance->next_version;
+
+    if (!fs_instance->config.delayed_allocation) {
+        int result = flush_delayed_file(fs_instance, node);
+        if (result != (int)OFSErrorCodes::SUCCESS) {
+            release_delayed(fs_instance, node);
+            if (was_inline) {
+                node->is_inline = true;
+                node->inline_data = old_content;
+            } else if (had_pending) {
+                buffer_delayed_write(fs_instance, node, old_content.data(), old_content.size());
+            }
+            fs_instance->reserved_blocks += old_reserved;
+            node->reserved_blocks = old_reserved;
+            node->tail = old_tail;
+            node->metadata.size = old_size;
+            return result;
+        }
+    } else if (fs_instance->pending_bytes > fs_instance->config.delalloc_max_pending_bytes) {
+        fs_flush_delayed(fs_instance, false);
+    }
+    release_fragment(fs_instance, old_tail);
     save_file_system(fs_instance);
     return (int)OFSErrorCodes::SUCCESS;
 }
 
-int file_truncate(void* instance, const char* path) {
+int file_write(void* instance, const char* path, const char* data, size_t size) {
     OFSInstance* fs_instance = (OFSInstance*)instance;
     if (fs_instance == nullptr) return (int)OFSErrorCodes::ERROR_INVALID_SESSION;
+
     FSTreeNode* node = find_node_by_path(fs_instance->fsTree.root, path);
     if (node == nullptr || node->isDirectory()) return (int)OFSErrorCodes::ERROR_NOT_FOUND;
+    fs_instance->file_cache.erase(node);
+
+    if (fits_inline(fs_instance, size) && node->prealloc_blocks == 0) return store_inline(fs_instance, node, data, size);
+    if (node->extents.empty()) return write_unplaced_content(fs_instance, node, data, size);
+    if (is_large_file(fs_instance, node) && !wants_large_blocks(fs_instance, size) && node->prealloc_blocks == 0) {
+        // No longer large: the content is placed again as a small file.
+        ExtentMap old_extents = node->extents;
+        size_t old_size = node->metadata.size;
+        node->extents.clear();
+        int result = write_unplaced_content(fs_instance, node, data, size);
+        if (result != (int)OFSErrorCodes::SUCCESS) {
+            node->extents = old_extents;
+            node->metadata.size = old_size;
+            return result;
+        }
+        free_extents(fs_instance, old_extents.list());
+        return result;
+    }
+    if (!map_blocks(fs_instance, node, 0, blocks_for_size(fs_instance, size))) return (int)OFSErrorCodes::ERROR_NO_SPACE;
+
+    if (!write_extents(fs_instance, node->extents, 0, data, size)) return (int)OFSErrorCodes::ERROR_IO_ERROR;
+    node->metadata.size = size;
+    node->version = ++fs_instance->next_version;
+
+    // Shrinking keeps the first block and anything preallocated with file_allocate.
+    size_t keep_blocks = class_blocks(fs_instance, node, max(max(blocks_for_size(fs_instance, size), (size_t)1), node->prealloc_blocks));
+    vector<Extent> freed = node->extents.truncate(keep_blocks);
+    FragmentRef old_tail = node->tail;
+    node->tail = {0, 0, 0};
     
-    node->metadata.size = 0;
-    
     save_file_system(fs_instance);
+    free_extents(fs_instance, freed);
+    release_fragment(fs_instance, old_tail);
+    pack_tail(fs_instance, node);
+    note_large_candidate(fs_instance, node);
+    return (int)OFSErrorCodes::SUCCESS;
+}
+
+int file_edit(void* instance, const char* path, const char* data, size_t size, uint64_t index) {
+    OFSInstance* fs_instance = (OFSInstance*)instance;
+    if (fs_instance == nullptr) return (int)OFSErrorCodes::ERROR_INVALID_SESSION;
+
+    FSTreeNode* node = find_node_by_path(fs_instance->fsTree.root, path);
+    if (node == nullptr || node->isDirectory()) return (int)OFSErrorCodes::ERROR_NOT_FOUND;
+    fs_instance->file_cache.erase(node);
+
+    size_t block_size = fs_instance->config.block_size;
+    size_t old_size = node->metadata.size;
+    size_t new_size = max(old_size, (size_t)(index + size));
+    // Writing past the end leaves the whole blocks in between as a hole.
+    bool opens_hole = index / block_size > blocks_for_size(fs_instance, old_size);
+
+    // A packed tail takes the write in place while it fits in its slots.
+    if (node->tail.slot_count > 0 && new_size > file_capacity(fs_instance, node) && !unpack_tail(fs_instance, node)) {
+        return (int)OFSErrorCodes::ERROR_NO_SPACE;
+    }
+    if (is_unplaced(node)) {
+        if (!opens_hole) {
+            string content = node->is_inline ? node->inline_data : node->pending_data;
+            content.resize(new_size, '\0');
+            if (size > 0) memcpy(&content[index], data, size);
+            if (fits_inline(fs_instance, new_size)) return store_inline(fs_instance, node, content.data(), content.size());
+            return write_unplaced_content(fs_instance, node, content.data(), content.size());
+        }
+        // Place what there is, so that only the blocks actually written get storage.
+        promote_inline(fs_instance, node);
+        int placed = flush_delayed_file(fs_instance, node);
+        if (placed != (int)OFSErrorCodes::SUCCESS) return placed;
+        if (!unpack_tail(fs_instance, node)) return (int)OFSErrorCodes::ERROR_NO_SPACE;
+    }
+
+    // Mapped bytes between the old end of file and the write may hold stale data;
+    // holes read as zeroes already.
+    if (index > old_size && !zero_file_range(fs_instance, node, old_size, index - old_size)) {
+        return (int)OFSErrorCodes::ERROR_IO_ERROR;
+    }
+
+    // Only the blocks covering the written range are touched, and those in a hole
+    // are zeroed around the write.
+    size_t first_block = index / block_size;
+    size_t end_block = blocks_for_size(fs_instance, index + size);
+    if (node->tail.slot_count > 0) end_block = min(end_block, node->extents.logicalEnd());
+    vector<Extent> mapped;
+    if (size > 0 && end_block > first_block && !map_blocks(fs_instance, node, first_block, end_block - first_block, &mapped)) {
+        return (int)OFSErrorCodes::ERROR_NO_SPACE;
+    }
+    for (const Extent& run : mapped) {
+        size_t run_begin = run.logical * block_size;
+        size_t run_end = min((run.logical + run.length) * block_size, new_size);
+        if (run_begin < index && !zero_file_range(fs_instance, node, run_begin, min(run_end, (size_t)index) - run_begin)) {
+            return (int)OFSErrorCodes::ERROR_IO_ERROR;
+        }
+        if (index + size < run_end && !zero_file_range(fs_instance, node, index + size, run_end - (index + size))) {
+            return (int)OFSErrorCodes::ERROR_IO_ERROR;
+        }
+    }
+    if (!write_file_range(fs_instance, node, index, data, size)) return (int)OFSErrorCodes::ERROR_IO_ERROR;
+
+    node->metadata.size = new_size;
+    node->version = ++fs_instance->next_version;
+    note_large_candidate(fs_instance, node);
+    save_file_system(fs_instance);
+    return (int)OFSErrorCodes::SUCCESS;
+}
+
+// Blocks an appended file holds past what its content and file_allocate need.
+static size_t append_slack_blocks(OFSInstance* fs_instance, FSTreeNode* node) {
+    size_t keep = class_blocks(fs_instance, node, max(max(blocks_for_size(fs_instance, node->metadata.size), (size_t)1), node->prealloc_blocks));
+    return node->extents.logicalEnd() > keep ? node->extents.logicalEnd() - keep : 0;
+}
+
+int file_append(void* instance, const char* path, const char* data, size_t size) {
+    OFSInstance* fs_instance = (OFSInstance*)instance;
+    if (fs_instance == nullptr) return (int)OFSErrorCodes::ERROR_INVALID_SESSION;
+
+    FSTreeNode* node = find_node_by_path(fs_instance->fsTree.root, path);
+    if (node == nullptr || node->isDirectory()) return (int)OFSErrorCodes::ERROR_NOT_FOUND;
+    fs_instance->file_cache.erase(node);
+
+    size_t old_size = node->metadata.size;
+    size_t new_size = old_size + size;
+
+    if (node->tail.slot_count > 0 && new_size > file_capacity(fs_instance, node) && !unpack_tail(fs_instance, node)) {
+        return (int)OFSErrorCodes::ERROR_NO_SPACE;
+    }
+    if (is_unplaced(node)) {
+        string content = node->is_inline ? node->inline_data : node->pending_data;
+        content.append(data, size);
+        if (fits_inline(fs_instance, new_size)) return store_inline(fs_instance, node, content.data(), content.size());
+        return write_unplaced_content(fs_instance, node, content.data(), content.size());
+    }
+    // A file ending in a hole is written like any other offset write.
+    if (old_size > file_capacity(fs_instance, node)) return file_edit(instance, path, data, size, old_size);
+
+    // Capacity doubles (up to append_prealloc_max_blocks at a time) so a run of
+    // appends costs amortized O(1) allocations; under space pressure only what the
+    // write needs is taken.
+    size_t blocks_needed = blocks_for_size(fs_instance, new_size);
+    size_t current_blocks = node->extents.logicalEnd();
+    if (new_size > file_capacity(fs_instance, node)) {
+        size_t step = min(current_blocks, (size_t)max(fs_instance->config.append_prealloc_max_blocks, 0));
+        size_t target_blocks = max(blocks_needed, current_blocks + step);
+        if (!map_blocks(fs_instance, node, current_blocks, target_blocks - current_blocks) &&
+            !map_blocks(fs_instance, node, current_blocks, blocks_needed - current_blocks)) {
+            return (int)OFSErrorCodes::ERROR_NO_SPACE;
+        }
+    }
+
+    if (!write_file_range(fs_instance, node, old_size, data, size)) return (int)OFSErrorCodes::ERROR_IO_ERROR;
+
+    node->metadata.size = new_size;
+    node->version = ++fs_instance->next_version;
+    node->last_append_ms = now_ms();
+    if (append_slack_blocks(fs_instance, node) > 0) fs_instance->append_nodes.insert(node);
+    note_large_candidate(fs_instance, node);
+    save_file_system(fs_instance);
+    return (int)OFSErrorCodes::SUCCESS;
+}
+
+// Gives back append capacity of files that have gone idle (or of every file when
+// forced, as at shutdown).
+int fs_trim_appends(void* instance, bool force) {
+    OFSInstance* fs_instance = (OFSInstance*)instance;
+    if (fs_instance == nullptr) return (int)OFSErrorCodes::ERROR_INVALID_SESSION;
+    if (fs_instance->append_nodes.empty()) return (int)OFSErrorCodes::SUCCESS;
+
+    uint64_t now = now_ms();
+    vector<Extent> freed;
+    vector<FSTreeNode*> packed;
+    for (auto it = fs_instance->append_nodes.begin(); it != fs_instance->append_nodes.end();) {
+        FSTreeNode* node = *it;
+        if (!force && now - node->last_append_ms < (uint64_t)fs_instance->config.append_trim_idle_ms) {
+            ++it;
+            continue;
+        }
+        size_t slack = append_slack_blocks(fs_instance, node);
+        vector<Extent> removed = node->extents.truncate(node->extents.logicalEnd() - slack);
+        freed.insert(freed.end(), removed.begin(), removed.end());
+        it = fs_instance->append_nodes.erase(it);
+        packed.push_back(node);
+    }
+
+    if (!freed.empty()) {
+        save_file_system(fs_instance);
+        free_extents(fs_instance, freed);
+    }
+    for (FSTreeNode* node : packed) {
+        pack_tail(fs_instance, node);
+        note_large_candidate(fs_instance, node);
+    }
+    return (int)OFSErrorCodes::SUCCESS;
+}
+
+// Sets the file's length. Growing leaves a hole; shrinking zeroes the rest of the
+// new last block and releases everything past it, including file_allocate
+// capacity, in one batch once the metadata no longer references it.
+int file_truncate(void* instance, const char* path, uint64_t length) {
+    OFSInstance* fs_instance = (OFSInstance*)instance;
+    if (fs_instance == nullptr) return (int)OFSErrorCodes::ERROR_INVALID_SESSION;
+    FSTreeNode* node = find_node_by_path(fs_instance->fsTree.root, path);
+    if (node == nullptr || node->isDirectory()) return (int)OFSErrorCodes::ERROR_NOT_FOUND;
+    fs_instance->file_cache.erase(node);
+
+    if (length > node->metadata.size) return file_edit(instance, path, "", 0, length);
+
+    bool unplaced = is_unplaced(node);
+    node->metadata.size = length;
+    node->version = ++fs_instance->next_version;
+    node->prealloc_blocks = 0;
+    fs_instance->append_nodes.erase(node);
+
+    if (node->is_inline) {
+        node->inline_data.resize(length);
+        save_file_system(fs_instance);
+        return (int)OFSErrorCodes::SUCCESS;
+    }
+    if (unplaced) {
+        if (node->has_pending) {
+            string content = node->pending_data.substr(0, length);
+            buffer_delayed_write(fs_instance, node, content.data(), content.size());
+        }
+        reserve_blocks(fs_instance, node, blocks_for_size(fs_instance, length));
+        save_file_system(fs_instance);
+        return (int)OFSErrorCodes::SUCCESS;
+    }
+
+    size_t keep_blocks = class_blocks(fs_instance, node, blocks_for_size(fs_instance, length));
+    size_t block_bytes = node->extents.logicalEnd() * fs_instance->config.block_size;
+    bool keeps_tail = node->tail.slot_count > 0 && length > block_bytes;
+    size_t zero_end = keeps_tail ? file_capacity(fs_instance, node)
+                                 : min(blocks_for_size(fs_instance, length) * fs_instance->config.block_size, block_bytes);
+    if (zero_end > length) {
+        if (!zero_file_range(fs_instance, node, length, zero_end - length)) return (int)OFSErrorCodes::ERROR_IO_ERROR;
+    }
+
+    vector<Extent> freed = node->extents.truncate(keep_blocks);
+    FragmentRef old_tail = keeps_tail ? FragmentRef{0, 0, 0} : node->tail;
+    if (!keeps_tail) node->tail = {0, 0, 0};
+
+    save_file_system(fs_instance);
+    free_extents(fs_instance, freed);
+    release_fragment(fs_instance, old_tail);
+    pack_tail(fs_instance, node);
+    return (int)OFSErrorCodes::SUCCESS;
+}
+
+int file_allocate(void* instance, const char* path, uint64_t length) {
+    OFSInstance* fs_instance = (OFSInstance*)instance;
+    if (fs_instance == nullptr) return (int)OFSErrorCodes::ERROR_INVALID_SESSION;
+    FSTreeNode* node = find_node_by_path(fs_instance->fsTree.root, path);
+    if (node == nullptr || node->isDirectory()) return (int)OFSErrorCodes::ERROR_NOT_FOUND;
+
+    // A sparse file is rewritten in one run, so its holes become allocated zeroes.
+    bool sparse = file_is_sparse(fs_instance, node);
+    size_t blocks_needed = blocks_for_size(fs_instance, sparse ? max(length, node->metadata.size) : length);
+    if (blocks_needed > node->extents.blockCount() && !unpack_tail(fs_instance, node)) return (int)OFSErrorCodes::ERROR_NO_SPACE;
+    size_t current_blocks = node->extents.blockCount();
+    // Only recorded once the blocks are there, so a failed call leaves the file as it was.
+    size_t prealloc_blocks = max(node->prealloc_blocks, blocks_needed);
+    if (blocks_needed <= current_blocks) {
+        node->prealloc_blocks = prealloc_blocks;
+        save_file_system(fs_instance);
+        return (int)OFSErrorCodes::SUCCESS;
+    }
+
+    // Large files grow by whole large blocks, next to their last one where possible.
+    if (is_large_file(fs_instance, node) && !sparse) {
+        if (!map_blocks(fs_instance, node, current_blocks, blocks_needed - current_blocks)) return (int)OFSErrorCodes::ERROR_NO_SPACE;
+        node->prealloc_blocks = prealloc_blocks;
+        save_file_system(fs_instance);
+        return (int)OFSErrorCodes::SUCCESS;
+    }
+
+    // Moving the file rewrites all of its content, which may be longer than length
+    // when it is still buffered or inline.
+    blocks_needed = max(blocks_needed, blocks_for_size(fs_instance, node->metadata.size));
+    size_t extra = blocks_needed - current_blocks;
+    size_t reserved_by_others = fs_instance->reserved_blocks - node->reserved_blocks;
+    size_t run = blocks_needed;
+    int64_t start_block = wants_large_blocks(fs_instance, blocks_needed * fs_instance->config.block_size)
+                          ? alloc_large_run(fs_instance, blocks_needed, run) : -1;
+    if (start_block == -1 && fs_instance->bitmap.freeBlockCount() < reserved_by_others + extra) return (int)OFSErrorCodes::ERROR_NO_SPACE;
+
+    if (start_block == -1 && current_blocks > 0 && !sparse) {
+        size_t next_block = node->extents.endBlock();
+        bool tail_free = next_block + extra <= fs_instance->bitmap.size();
+        for (size_t i = next_block; tail_free && i < next_block + extra; ++i) {
+            if (fs_instance->bitmap.isBlockSet(i)) tail_free = false;
+        }
+        if (tail_free) {
+            claim_tail_blocks(fs_instance, node, extra);
+            node->prealloc_blocks = prealloc_blocks;
+            save_file_system(fs_instance);
+            return (int)OFSErrorCodes::SUCCESS;
+        }
+    }
+
+    if (start_block == -1) {
+        start_block = fs_instance->bitmap.findFreeBlocks(blocks_needed);
+        if (start_block == -1) return (int)OFSErrorCodes::ERROR_NO_SPACE;
+        fs_instance->bitmap.setBlocks(start_block, blocks_needed);
+    }
+
+    char* content = nullptr;
+    size_t content_size = 0;
+    int result = file_read(instance, path, &content, &content_size);
+    if (result != (int)OFSErrorCodes::SUCCESS) {
+        free_block_run(fs_instance, start_block, run);
+        return result;
+    }
+
+    if (content_size > run * fs_instance->config.block_size) {
+        free_buffer(content);
+        free_block_run(fs_instance, start_block, run);
+        return (int)OFSErrorCodes::ERROR_IO_ERROR;
+    }
+    if (content_size > 0) {
+        bool ok = cached_write(fs_instance, (size_t)start_block * fs_instance->config.block_size, content, content_size);
+        free_buffer(content);
+        if (!ok) {
+            free_block_run(fs_instance, start_block, run);
+            return (int)OFSErrorCodes::ERROR_IO_ERROR;
+        }
+    }
+
+    vector<Extent> old_extents = node->extents.list();
+    node->extents.clear();
+    node->extents.append(start_block, run);
+    node->metadata.inode = start_block;
+    node->is_inline = false;
+    node->inline_data.clear();
+    node->version = ++fs_instance->next_version;
+    node->prealloc_blocks = prealloc_blocks;
+    release_delayed(fs_instance, node);
+
+    save_file_system(fs_instance);
+    free_extents(fs_instance, old_extents);
     return (int)OFSErrorCodes::SUCCESS;
 }
 
@@ -657,7 +1419,8 @@ int get_metadata(void* instance, const char* path, FileMetadata* meta) {
     FSTreeNode* node = find_node_by_path(fs_instance->fsTree.root, path);
     if (node == nullptr) return (int)OFSErrorCodes::ERROR_NOT_FOUND;
     meta->entry = node->metadata;
-    meta->blocks_used = node->data_blocks.size();
+    meta->blocks_used = node->extents.blockCount();
+    meta->actual_size = file_allocated_bytes(fs_instance, node);
     return (int)OFSErrorCodes::SUCCESS;
 }
 
@@ -701,12 +1464,39 @@ int get_stats(void* instance, FSStats* stats) {
     stats->total_directories = total_dirs;
     stats->used_space = used_space;
     stats->free_space = stats->total_size - used_space;
+    stats->fragmentation = fs_instance->bitmap.fragmentation();
     stats->total_users = fs_instance->userTree.listAllUsers().size();
     lock_guard<mutex> lock(fs_instance->session_mutex);
     stats->active_sessions = fs_instance->active_sessions.size();
     return (int)OFSErrorCodes::SUCCESS;
 }
 
+int get_free_space_stats(void* instance, FreeSpaceStats* stats) {
+    OFSInstance* fs_instance = (OFSInstance*)instance;
+    if (fs_instance == nullptr) return (int)OFSErrorCodes::ERROR_INVALID_SESSION;
+
+    const FreeSpaceBitmap& bitmap = fs_instance->bitmap;
+    stats->free_blocks = bitmap.freeBlockCount();
+    stats->free_extents = bitmap.freeExtentCount();
+    stats->largest_free_extent = bitmap.largestFreeExtent();
+    stats->reserved_blocks = fs_instance->reserved_blocks;
+    stats->pending_bytes = fs_instance->pending_bytes;
+    stats->large_region_blocks = fs_instance->large_bitmap.size() * fs_instance->large_unit;
+    stats->large_free_blocks = large_free_blocks(fs_instance);
+    stats->fragment_blocks = fs_instance->fragments.blockCount();
+    stats->packed_tails = fs_instance->fragments.fragmentCount();
+    stats->tail_bytes_reclaimed = (stats->packed_tails > stats->fragment_blocks)
+        ? (stats->packed_tails - stats->fragment_blocks) * fs_instance->config.block_size : 0;
+    stats->punch_pending_blocks = fs_instance->punch_queued_blocks;
+    stats->punched_blocks = fs_instance->punched_blocks;
+    stats->append_slack_blocks = 0;
+    for (FSTreeNode* node : fs_instance->append_nodes) stats->append_slack_blocks += append_slack_blocks(fs_instance, node);
+    for (int i = 0; i < FreeSpaceBitmap::HISTOGRAM_BUCKETS; ++i) {
+        stats->free_run_histogram[i] = bitmap.freeRunHistogram()[i];
+    }
+    return (int)OFSErrorCodes::SUCCESS;
+}
+
 void free_buffer(char* buffer) {
     if (buffer) delete[] buffer;
 }
@@ -8,6 +8,7 @@ using namespace std;
 int fs_format(const string& omni_path, const string& config_path);
 int fs_init(void** instance, const string& omni_path, const string& config_path);
 void fs_shutdown(void* instance);
+int fs_grow(void* instance, uint64_t new_size);
 
 int user_create(void* admin_session, const char* username, const char* password, UserRole role);
 int user_list(void* admin_session, UserInfo** users, int* count);
@@ -30,12 +31,28 @@ int file_delete(void* instance, const char* path);
 int file_exists(void* instance, const char* path);
 
 int file_read(void* instance, const char* path, char** buffer, size_t* size);
-int file_edit(void* instance, const char* path, const char* data, size_t size, uint32_t index);
-int file_truncate(void* instance, const char* path);
+int file_read_range(void* instance, const char* path, uint64_t offset, uint64_t length, char** buffer, size_t* size);
+int file_send(void* instance, const char* path, uint64_t offset, uint64_t length, int out_fd);
+int file_edit(void* instance, const char* path, const char* data, size_t size, uint64_t index);
+int file_write(void* instance, const char* path, const char* data, size_t size);
+int file_append(void* instance, const char* path, const char* data, size_t size);
+int file_truncate(void* instance, const char* path, uint64_t length);
+int file_allocate(void* instance, const char* path, uint64_t length);
 int file_rename(void* instance, const char* old_path, const char* new_path);
 
 int get_metadata(void* instance, const char* path, FileMetadata* meta);
 int set_permissions(void* instance, const char* path, uint32_t permissions);
 int get_stats(void* instance, FSStats* stats);
+int get_free_space_stats(void* instance, FreeSpaceStats* stats);
+int get_defrag_stats(void* instance, DefragStats* stats);
+int get_cache_stats(void* instance, BlockCacheStats* stats);
+int get_file_cache_stats(void* instance, FileCacheStats* stats);
+int get_io_stats(void* instance, IOStats* stats);
+int fs_defrag_step(void* instance, size_t block_budget);
+int fs_flush_delayed(void* instance, bool force);
+int fs_trim_appends(void* instance, bool force);
+int fs_compact_fragments(void* instance);
+int fs_punch_freed(void* instance, bool force);
+int fs_flush_writeback(void* instance, bool force);
 void free_buffer(char* buffer);
 const char* get_error_message(int error_code);
\ No newline at end of file
@@ -2,18 +2,77 @@
 #include "../data_structures/user_avl_tree.hpp"
 #include "../data_structures/fs_tree.hpp"
 #include "../data_structures/free_space_bitmap.hpp"
+#include "../data_structures/block_cache.hpp"
+#include "../data_structures/file_cache.hpp"
+#include "../data_structures/aligned_buffer_pool.hpp"
 #include "config_parser.hpp"
+#include "defragmenter.hpp"
 #include <mutex>
 #include <string>
 #include <vector>
+#include <set>
+#include <map>
 #include "../include/odf_types.hpp"
 
+// System calls made for data-block I/O on the container and the bytes they moved.
+struct IOStats {
+    uint64_t read_calls;
+    uint64_t read_bytes;
+    uint64_t write_calls;
+    uint64_t write_bytes;
+    uint64_t sendfile_calls;
+    uint64_t sendfile_bytes;
+    uint64_t direct_calls;      // Reads and writes that bypassed the page cache
+    uint64_t bounced_bytes;     // Direct I/O copied through a pool buffer for alignment
+};
+
 struct OFSInstance {
     std::string omni_path;
     Config config;
     UserAVLTree userTree;
     FileSystemTree fsTree;
     FreeSpaceBitmap bitmap;
+    FragmentAllocator fragments;
+    size_t fragment_size = 0;
+    // Container layout from the header. fs_grow extends the container and moves the
+    // bitmap into the new space when it outgrows its region.
+    size_t bitmap_offset = 0;
+    size_t bitmap_size = 0;
+    size_t data_start_block = 0;
+    // Metadata table: metadata_slots records after the user table, then overflow
+    // extents from the data area holding metadata_extent_slots records each, so a
+    // slot finds its extent by division.
+    size_t metadata_offset = 0;
+    size_t metadata_slots = 0;
+    size_t metadata_extent_slots = 0;
+    std::vector<size_t> metadata_extents;   // First block of each overflow extent, in chain order
+    size_t metadata_chain_saved = 0;        // Chain start currently recorded in the header
+    uint64_t compact_idle_generation = UINT64_MAX;
+    // Large-block class: a region at the end of the container (as formatted) allocated
+    // in units of large_unit blocks. The main bitmap keeps the whole region marked as used.
+    FreeSpaceBitmap large_bitmap;
+    size_t large_unit = 0;
+    size_t large_start = 0;
     std::vector<SessionInfo> active_sessions;
     std::mutex session_mutex;
+    uint64_t next_version = 0;
+    size_t reserved_blocks = 0;
+    size_t pending_bytes = 0;
+    std::set<FSTreeNode*> pending_nodes;
+    std::set<FSTreeNode*> append_nodes;     // Files holding append capacity past EOF
+    // Freed runs waiting to be punched out of the host file, merged by start block.
+    std::map<size_t, size_t> punch_queue;
+    size_t punch_queued_blocks = 0;
+    uint64_t punched_blocks = 0;
+    bool punch_unsupported = false;
+    int data_fd = -1;                       // Container descriptor for data-block I/O, open while mounted
+    int direct_fd = -1;                     // O_DIRECT descriptor when direct_io is on and the host allows it
+    AlignedBufferPool direct_buffers;       // Block-aligned bounce buffers for direct_fd
+    IOStats io_stats = {};
+    BlockCache block_cache;                 // Data blocks only; metadata I/O bypasses it
+    uint64_t dirty_since_ms = 0;            // Write-back: when the oldest dirty block was written
+    uint64_t written_back_blocks = 0;
+    uint64_t write_back_runs = 0;
+    FileCache file_cache;                   // Whole contents of small files served by file_read
+    DefragState defrag;
 };
\ No newline at end of file
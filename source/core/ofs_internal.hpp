@@ -0,0 +1,102 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <iostream>
+#include <functional>
+#include <sys/uio.h>
+#include "ofs_instance.hpp"
+
+using namespace std;
+
+// v1.1: metadata slots are FSTreeNode_Disk records carrying the file's extents.
+// v1.2: records have room for inline file content.
+// v1.3: records reference a packed tail fragment; the header stores the fragment size.
+// v1.4: extent lists may contain holes (entries with start 0).
+// v1.5: the header describes a large-block region at the end of the container.
+// v1.6: block numbers, counts and offsets in the header and records are 64-bit.
+// v1.7: the header locates the bitmap, the data area and the large region, so the container can grow.
+// v1.8: the metadata table continues in overflow extents chained from the header.
+const uint32_t OFS_FORMAT_VERSION = 0x00010008;
+
+FSTreeNode* find_node_by_path(FSTreeNode* root, const string& path);
+void collect_nodes(FSTreeNode* node, string current_path, vector<pair<string, FSTreeNode*>>& all_nodes);
+void parse_path(const string& path, string& parent_path, string& child_name);
+void save_file_system(OFSInstance* fs_instance);
+bool update_header(OFSInstance* fs_instance, const function<void(OMNIHeader&)>& change);
+bool sync_container(OFSInstance* fs_instance);
+void free_extents(OFSInstance* fs_instance, const vector<Extent>& extents);
+
+// Positioned I/O on data_fd, counted in io_stats. Short transfers are resumed.
+bool container_read(OFSInstance* fs_instance, size_t offset, char* buffer, size_t length);
+bool container_write(OFSInstance* fs_instance, size_t offset, const char* data, size_t length);
+bool container_readv(OFSInstance* fs_instance, size_t offset, struct iovec* iov, int count);
+bool container_writev(OFSInstance* fs_instance, size_t offset, struct iovec* iov, int count);
+// Opens direct_fd when direct_io is set, or explains why buffered I/O is kept.
+void init_direct_io(OFSInstance* fs_instance);
+void close_direct_io(OFSInstance* fs_instance);
+
+// Container I/O through the block cache. Writes go straight to disk and patch any
+// cached copy, or with write_back only land in the cache; callers freeing blocks
+// invalidate them.
+bool cached_read(OFSInstance* fs_instance, size_t disk_offset, char* buffer, size_t length);
+bool cached_write(OFSInstance* fs_instance, size_t disk_offset, const char* data, size_t length);
+bool cached_prefetch(OFSInstance* fs_instance, size_t disk_offset, size_t length);
+bool write_back_dirty(OFSInstance* fs_instance);
+void init_write_back(OFSInstance* fs_instance);
+
+// Byte-range I/O over a file's extents. Reads return zeroes for holes; writes fail
+// on them, so the blocks must be mapped first.
+bool read_extents(OFSInstance* fs_instance, const ExtentMap& extents, size_t offset, char* buffer, size_t length);
+bool write_extents(OFSInstance* fs_instance, const ExtentMap& extents, size_t offset, const char* data, size_t length);
+// Same over a whole file, covering its extents and then its packed tail.
+size_t file_capacity(OFSInstance* fs_instance, FSTreeNode* node);
+size_t file_allocated_bytes(OFSInstance* fs_instance, FSTreeNode* node);
+bool file_is_sparse(OFSInstance* fs_instance, FSTreeNode* node);
+bool read_file_range(OFSInstance* fs_instance, FSTreeNode* node, size_t offset, char* buffer, size_t length);
+bool write_file_range(OFSInstance* fs_instance, FSTreeNode* node, size_t offset, const char* data, size_t length);
+// Loads the mapped parts of a range into the block cache without copying them out.
+bool prefetch_file_range(OFSInstance* fs_instance, FSTreeNode* node, size_t offset, size_t length);
+// Copies a range to out_fd: mapped runs with sendfile from the container, holes as
+// zeroes. Dirty write-back blocks must have been written back.
+bool send_file_range(int out_fd, OFSInstance* fs_instance, FSTreeNode* node, size_t offset, size_t length);
+bool send_bytes(int out_fd, const char* data, size_t length);
+// Overwrites the mapped parts of a range with zeroes and leaves its holes alone.
+bool zero_file_range(OFSInstance* fs_instance, FSTreeNode* node, size_t offset, size_t length);
+
+uint64_t now_ms();
+size_t blocks_for_size(OFSInstance* fs_instance, size_t size);
+bool reserve_blocks(OFSInstance* fs_instance, FSTreeNode* node, size_t blocks);
+void buffer_delayed_write(OFSInstance* fs_instance, FSTreeNode* node, const char* data, size_t size);
+void release_delayed(OFSInstance* fs_instance, FSTreeNode* node);
+int flush_delayed_file(OFSInstance* fs_instance, FSTreeNode* node);
+
+bool tail_packable(OFSInstance* fs_instance, FSTreeNode* node, size_t size);
+bool write_tail_fragment(OFSInstance* fs_instance, FSTreeNode* node, const char* data, size_t length);
+void release_fragment(OFSInstance* fs_instance, const FragmentRef& ref);
+void drop_tail(OFSInstance* fs_instance, FSTreeNode* node);
+bool pack_tail(OFSInstance* fs_instance, FSTreeNode* node);
+bool unpack_tail(OFSInstance* fs_instance, FSTreeNode* node);
+
+bool in_large_region(OFSInstance* fs_instance, size_t block);
+bool is_large_file(OFSInstance* fs_instance, FSTreeNode* node);
+bool wants_large_blocks(OFSInstance* fs_instance, size_t size);
+// Rounds a block count up to whole large blocks for files in the large region.
+size_t class_blocks(OFSInstance* fs_instance, FSTreeNode* node, size_t blocks);
+size_t large_free_blocks(OFSInstance* fs_instance);
+int64_t alloc_large_run(OFSInstance* fs_instance, size_t blocks, size_t& run, bool allow_partial = false);
+size_t claim_large_after(OFSInstance* fs_instance, size_t next_block, size_t max_blocks);
+// Returns a physical run to whichever allocator owns it.
+void free_block_run(OFSInstance* fs_instance, size_t start, size_t length);
+void note_large_candidate(OFSInstance* fs_instance, FSTreeNode* node);
+void init_block_classes(OFSInstance* fs_instance, size_t large_block_size, size_t region_start, size_t region_blocks);
+
+size_t metadata_capacity(OFSInstance* fs_instance);
+size_t metadata_extent_blocks(OFSInstance* fs_instance);
+size_t metadata_slot_offset(OFSInstance* fs_instance, size_t slot);
+bool metadata_region_start(OFSInstance* fs_instance, size_t slot);
+bool grow_metadata_table(OFSInstance* fs_instance, size_t slots);
+void write_metadata_chain(OFSInstance* fs_instance, ostream& omni_file);
+void load_metadata_chain(OFSInstance* fs_instance, istream& omni_file, size_t chain_start);
+
+// Queues a freed run to be punched out of the host file when punch_freed_blocks is on.
+void queue_punch(OFSInstance* fs_instance, size_t start, size_t length);
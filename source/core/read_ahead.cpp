@@ -0,0 +1,70 @@
+#include "ofs_api.hpp"
+#include "ofs_internal.hpp"
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+// Ranged reads that pick up where the previous one on the same file stopped are
+// treated as a stream: the blocks after the range are read into the block cache
+// in the same pass, so the next read is served from memory. The window starts
+// small, doubles while reads are served entirely from the cache and halves when
+// prefetched blocks were evicted before use. A read elsewhere ends the stream.
+
+static const size_t READAHEAD_INITIAL_BLOCKS = 4;
+
+static void read_ahead(OFSInstance* fs_instance, FSTreeNode* node, size_t offset, size_t length, bool missed) {
+    // A window near the cache size would evict its own blocks before they are read.
+    size_t max_window = min((size_t)max(fs_instance->config.readahead_max_blocks, 0),
+                            (size_t)fs_instance->block_cache.stats().capacity_blocks / 4);
+    bool sequential = offset == node->read_next;
+    node->read_next = offset + length;
+    if (!sequential || max_window == 0 || !fs_instance->block_cache.enabled()) {
+        node->readahead_window = 0;
+        return;
+    }
+
+    size_t initial = min(READAHEAD_INITIAL_BLOCKS, max_window);
+    size_t& window = node->readahead_window;
+    if (window == 0) window = initial;
+    else if (!missed) window = min(window * 2, max_window);
+    else window = max(window / 2, initial);
+
+    // Fetch at least as much as the reader asks for per call, so a stream of large
+    // reads still finds its next range cached.
+    size_t block_size = fs_instance->config.block_size;
+    size_t fetch = max(window, (length + block_size - 1) / block_size) * block_size;
+    size_t end = min((size_t)node->metadata.size, node->read_next + fetch);
+    if (end > node->read_next) prefetch_file_range(fs_instance, node, node->read_next, end - node->read_next);
+}
+
+int file_read_range(void* instance, const char* path, uint64_t offset, uint64_t length, char** buffer, size_t* size) {
+    OFSInstance* fs_instance = (OFSInstance*)instance;
+    if (fs_instance == nullptr) return (int)OFSErrorCodes::ERROR_INVALID_SESSION;
+
+    FSTreeNode* node = find_node_by_path(fs_instance->fsTree.root, path);
+    if (node == nullptr || node->isDirectory()) return (int)OFSErrorCodes::ERROR_NOT_FOUND;
+
+    size_t file_size = node->metadata.size;
+    *size = offset < file_size ? (size_t)min<uint64_t>(length, file_size - offset) : 0;
+    if (*size == 0) { *buffer = nullptr; return (int)OFSErrorCodes::SUCCESS; }
+
+    *buffer = new char[*size + 1];
+    (*buffer)[*size] = 0;
+    if (node->is_inline) {
+        memcpy(*buffer, node->inline_data.data() + offset, *size);
+        return (int)OFSErrorCodes::SUCCESS;
+    }
+    if (node->has_pending) {
+        memcpy(*buffer, node->pending_data.data() + offset, *size);
+        return (int)OFSErrorCodes::SUCCESS;
+    }
+
+    uint64_t misses = fs_instance->block_cache.stats().misses;
+    if (!read_file_range(fs_instance, node, offset, *buffer, *size)) {
+        delete[] *buffer;
+        return (int)OFSErrorCodes::ERROR_IO_ERROR;
+    }
+    read_ahead(fs_instance, node, offset, *size, fs_instance->block_cache.stats().misses != misses);
+    return (int)OFSErrorCodes::SUCCESS;
+}
@@ -0,0 +1,164 @@
+#include "ofs_api.hpp"
+#include "ofs_internal.hpp"
+
+using namespace std;
+
+static size_t fragment_slots(OFSInstance* fs_instance, size_t bytes) {
+    return (bytes + fs_instance->fragment_size - 1) / fs_instance->fragment_size;
+}
+
+static size_t fragment_offset(OFSInstance* fs_instance, const FragmentRef& ref) {
+    return (size_t)ref.block * fs_instance->config.block_size + (size_t)ref.first_slot * fs_instance->fragment_size;
+}
+
+// Files that are still being appended to or hold file_allocate capacity keep whole blocks.
+bool tail_packable(OFSInstance* fs_instance, FSTreeNode* node, size_t size) {
+    if (fs_instance->fragment_size == 0 || node->prealloc_blocks > 0 || fs_instance->append_nodes.count(node)) return false;
+    if (wants_large_blocks(fs_instance, size) || is_large_file(fs_instance, node)) return false;
+    size_t tail = size % fs_instance->config.block_size;
+    return tail > 0 && tail <= (size_t)fs_instance->config.tail_pack_max_bytes &&
+           fragment_slots(fs_instance, tail) < fs_instance->fragments.slotsPerBlock();
+}
+
+// Finds room for a fragment, turning a free data block into a fragment block when
+// no existing one has space.
+static bool alloc_fragment(OFSInstance* fs_instance, size_t slots, FragmentRef& ref, int64_t exclude_block = -1) {
+    if (fs_instance->fragments.allocate(slots, ref, exclude_block)) return true;
+
+    int64_t block = fs_instance->bitmap.findFreeBlocks(1);
+    if (block == -1) return false;
+    fs_instance->bitmap.setBlock(block);
+    fs_instance->fragments.addBlock(block);
+    return fs_instance->fragments.allocate(slots, ref, exclude_block);
+}
+
+void release_fragment(OFSInstance* fs_instance, const FragmentRef& ref) {
+    if (ref.slot_count == 0) return;
+    if (fs_instance->fragments.release(ref)) {
+        fs_instance->bitmap.freeBlock(ref.block);
+        queue_punch(fs_instance, ref.block, 1);
+        fs_instance->block_cache.invalidate(ref.block, 1);
+    }
+}
+
+void drop_tail(OFSInstance* fs_instance, FSTreeNode* node) {
+    release_fragment(fs_instance, node->tail);
+    node->tail = {0, 0, 0};
+}
+
+bool write_tail_fragment(OFSInstance* fs_instance, FSTreeNode* node, const char* data, size_t length) {
+    FragmentRef ref;
+    if (!alloc_fragment(fs_instance, fragment_slots(fs_instance, length), ref)) return false;
+
+    if (!cached_write(fs_instance, fragment_offset(fs_instance, ref), data, length)) {
+        release_fragment(fs_instance, ref);
+        return false;
+    }
+    node->tail = ref;
+    return true;
+}
+
+// Moves the last partial block of a placed file into a fragment and frees the block.
+bool pack_tail(OFSInstance* fs_instance, FSTreeNode* node) {
+    size_t size = node->metadata.size;
+    size_t block_size = fs_instance->config.block_size;
+    if (node->tail.slot_count > 0 || node->is_inline || node->extents.empty()) return false;
+    if (!tail_packable(fs_instance, node, size) || node->extents.hasHoles() ||
+        node->extents.logicalEnd() != blocks_for_size(fs_instance, size)) {
+        return false;
+    }
+
+    size_t full_bytes = size - size % block_size;
+    string tail(size - full_bytes, '\0');
+    if (!read_extents(fs_instance, node->extents, full_bytes, &tail[0], tail.size())) return false;
+    if (!write_tail_fragment(fs_instance, node, tail.data(), tail.size())) return false;
+
+    vector<Extent> freed = node->extents.truncate(full_bytes / block_size);
+    save_file_system(fs_instance);
+    free_extents(fs_instance, freed);
+    return true;
+}
+
+// Gives a packed tail a whole block again, ahead of writes that outgrow its slots.
+bool unpack_tail(OFSInstance* fs_instance, FSTreeNode* node) {
+    if (node->tail.slot_count == 0) return true;
+
+    size_t block_size = fs_instance->config.block_size;
+    size_t length = min((size_t)node->metadata.size - node->extents.logicalEnd() * block_size,
+                        (size_t)node->tail.slot_count * fs_instance->fragment_size);
+    size_t reserved_by_others = fs_instance->reserved_blocks - node->reserved_blocks;
+    if (fs_instance->bitmap.freeBlockCount() <= reserved_by_others) return false;
+
+    int64_t target = -1;
+    if (!node->extents.empty() && node->extents.endBlock() < fs_instance->bitmap.size() &&
+        !fs_instance->bitmap.isBlockSet(node->extents.endBlock())) {
+        target = node->extents.endBlock();
+    } else {
+        target = fs_instance->bitmap.findFreeBlocks(1);
+    }
+    if (target == -1) return false;
+
+    vector<char> block(block_size, 0);
+    if (!cached_read(fs_instance, fragment_offset(fs_instance, node->tail), block.data(), length)) return false;
+    if (!cached_write(fs_instance, (size_t)target * block_size, block.data(), block_size)) return false;
+
+    fs_instance->bitmap.setBlock(target);
+    if (!node->extents.empty() && node->extents.endBlock() != (size_t)target) fs_instance->defrag.fragmented_files = true;
+    node->extents.append(target, 1);
+    if (node->extents.blockCount() == 1) node->metadata.inode = target;
+
+    FragmentRef old_tail = node->tail;
+    node->tail = {0, 0, 0};
+    save_file_system(fs_instance);
+    release_fragment(fs_instance, old_tail);
+    return true;
+}
+
+// Empties the least-used fragment block into the others once the fragments would
+// fit in fewer blocks. One block is handled per call.
+int fs_compact_fragments(void* instance) {
+    OFSInstance* fs_instance = (OFSInstance*)instance;
+    if (fs_instance == nullptr) return (int)OFSErrorCodes::ERROR_INVALID_SESSION;
+
+    FragmentAllocator& fragments = fs_instance->fragments;
+    size_t slots_per_block = fragments.slotsPerBlock();
+    if (slots_per_block == 0 || fragments.generation() == fs_instance->compact_idle_generation) {
+        return (int)OFSErrorCodes::SUCCESS;
+    }
+    size_t blocks_needed = (fragments.usedSlots() + slots_per_block - 1) / slots_per_block;
+    int64_t victim = fragments.emptiestBlock();
+    if (fragments.blockCount() <= blocks_needed || victim == -1) {
+        fs_instance->compact_idle_generation = fragments.generation();
+        return (int)OFSErrorCodes::SUCCESS;
+    }
+
+    vector<pair<string, FSTreeNode*>> all_nodes;
+    collect_nodes(fs_instance->fsTree.root, "/", all_nodes);
+
+    vector<FragmentRef> moved;
+    vector<char> buffer(fs_instance->config.block_size);
+    for (const auto& item : all_nodes) {
+        FSTreeNode* node = item.second;
+        if (node->tail.slot_count == 0 || (int64_t)node->tail.block != victim) continue;
+
+        FragmentRef target;
+        if (!fragments.allocate(node->tail.slot_count, target, victim)) break;
+        size_t length = (size_t)node->tail.slot_count * fs_instance->fragment_size;
+        if (!cached_read(fs_instance, fragment_offset(fs_instance, node->tail), buffer.data(), length) ||
+            !cached_write(fs_instance, fragment_offset(fs_instance, target), buffer.data(), length)) {
+            release_fragment(fs_instance, target);
+            break;
+        }
+        moved.push_back(node->tail);
+        node->tail = target;
+    }
+
+    if (moved.empty()) {
+        fs_instance->compact_idle_generation = fragments.generation();
+        return (int)OFSErrorCodes::SUCCESS;
+    }
+    if (!sync_container(fs_instance)) return (int)OFSErrorCodes::ERROR_IO_ERROR;
+    save_file_system(fs_instance);
+    for (const FragmentRef& ref : moved) release_fragment(fs_instance, ref);
+    return (int)OFSErrorCodes::SUCCESS;
+}
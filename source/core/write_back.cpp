@@ -0,0 +1,61 @@
+#include "ofs_api.hpp"
+#include "ofs_internal.hpp"
+
+using namespace std;
+
+// With write_back on, written blocks wait in the block cache as dirty blocks and
+// are written back in block order, adjacent blocks merged into one write: by the
+// idle step once the oldest has waited write_back_flush_ms, at once when more than
+// write_back_max_dirty_bytes are waiting, before every sync_container, and at
+// shutdown. An evicted dirty block is written on its own first. Metadata is not
+// held back, so a crash loses the data still waiting, as with delayed allocation.
+
+// Longest run of adjacent dirty blocks merged into one write.
+static const size_t WRITE_BACK_RUN_BLOCKS = 256;
+
+bool write_back_dirty(OFSInstance* fs_instance) {
+    BlockCache& cache = fs_instance->block_cache;
+    if (cache.dirtyBlocks().empty()) return true;
+
+    // Each run is written straight from the cache frames, one iovec per block.
+    size_t block_size = fs_instance->config.block_size;
+    vector<size_t> blocks(cache.dirtyBlocks().begin(), cache.dirtyBlocks().end());
+    vector<struct iovec> run;
+    size_t first = 0;
+    while (first < blocks.size()) {
+        size_t last = first + 1;
+        while (last < blocks.size() && blocks[last] == blocks[last - 1] + 1 && last - first < WRITE_BACK_RUN_BLOCKS) last++;
+        run.clear();
+        for (size_t i = first; i < last; ++i) run.push_back({(void*)cache.peek(blocks[i]), block_size});
+        if (!container_writev(fs_instance, blocks[first] * block_size, run.data(), run.size())) return false;
+        for (size_t i = first; i < last; ++i) cache.markClean(blocks[i]);
+        fs_instance->written_back_blocks += last - first;
+        fs_instance->write_back_runs++;
+        first = last;
+    }
+    return true;
+}
+
+void init_write_back(OFSInstance* fs_instance) {
+    fs_instance->block_cache.setWriteBack([fs_instance](size_t block, const char* data) {
+        size_t block_size = fs_instance->config.block_size;
+        if (!container_write(fs_instance, block * block_size, data, block_size)) {
+            cerr << "write-back: lost dirty block " << block << " on eviction." << endl;
+            return;
+        }
+        fs_instance->written_back_blocks++;
+        fs_instance->write_back_runs++;
+    });
+}
+
+int fs_flush_writeback(void* instance, bool force) {
+    OFSInstance* fs_instance = (OFSInstance*)instance;
+    if (fs_instance == nullptr) return (int)OFSErrorCodes::ERROR_INVALID_SESSION;
+    if (fs_instance->block_cache.dirtyBlocks().empty()) return (int)OFSErrorCodes::SUCCESS;
+    if (!force && now_ms() - fs_instance->dirty_since_ms < (uint64_t)fs_instance->config.write_back_flush_ms) {
+        return (int)OFSErrorCodes::SUCCESS;
+    }
+
+    if (!write_back_dirty(fs_instance)) return (int)OFSErrorCodes::ERROR_IO_ERROR;
+    return (int)OFSErrorCodes::SUCCESS;
+}
@@ -0,0 +1,58 @@
+#include "aligned_buffer_pool.hpp"
+#include <cstdlib>
+
+AlignedBufferPool::AlignedBufferPool() : alignment(0), buffer_bytes(0), max_free(0), allocation_count(0)
+{
+}
+
+AlignedBufferPool::~AlignedBufferPool()
+{
+    for (char* buffer : free_buffers)
+    {
+        free(buffer);
+    }
+}
+
+void AlignedBufferPool::initialize(size_t align, size_t buffer_size, size_t max_free_buffers)
+{
+    for (char* buffer : free_buffers)
+    {
+        free(buffer);
+    }
+    free_buffers.clear();
+    alignment = align;
+    buffer_bytes = buffer_size;
+    max_free = max_free_buffers;
+    allocation_count = 0;
+}
+
+char* AlignedBufferPool::acquire()
+{
+    if (!free_buffers.empty())
+    {
+        char* buffer = free_buffers.back();
+        free_buffers.pop_back();
+        return buffer;
+    }
+    void* buffer = nullptr;
+    if (buffer_bytes == 0 || posix_memalign(&buffer, alignment, buffer_bytes) != 0)
+    {
+        return nullptr;
+    }
+    allocation_count++;
+    return (char*)buffer;
+}
+
+void AlignedBufferPool::release(char* buffer)
+{
+    if (buffer == nullptr)
+    {
+        return;
+    }
+    if (free_buffers.size() < max_free)
+    {
+        free_buffers.push_back(buffer);
+        return;
+    }
+    free(buffer);
+}
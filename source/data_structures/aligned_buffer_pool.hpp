@@ -0,0 +1,41 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+// Reusable buffers of one size whose addresses are multiples of the alignment, for
+// I/O that bypasses the page cache. Released buffers are kept for the next acquire,
+// up to max_free of them; the rest are freed.
+class AlignedBufferPool
+{
+private:
+    size_t alignment;
+    size_t buffer_bytes;
+    size_t max_free;
+    vector<char*> free_buffers;
+    uint64_t allocation_count;
+
+public:
+    AlignedBufferPool();
+    ~AlignedBufferPool();
+    AlignedBufferPool(const AlignedBufferPool&) = delete;
+    AlignedBufferPool& operator=(const AlignedBufferPool&) = delete;
+
+    // buffer_size must be a multiple of align, and align a power of two.
+    void initialize(size_t align, size_t buffer_size, size_t max_free_buffers);
+    // Returns nullptr when the allocation fails.
+    char* acquire();
+    void release(char* buffer);
+
+    size_t bufferSize() const
+    {
+        return buffer_bytes;
+    }
+    // Buffers allocated so far; stays low while buffers are being reused.
+    uint64_t allocations() const
+    {
+        return allocation_count;
+    }
+};
@@ -0,0 +1,340 @@
+#include "block_cache.hpp"
+#include <cstring>
+#include <algorithm>
+
+static const size_t NO_FRAME = SIZE_MAX;
+
+BlockCache::BlockCache() : block_size(0), capacity(0), recency_target(0), frames(nullptr), last_block(SIZE_MAX), hit_count(0), miss_count(0), eviction_count(0),
+    prefetch_count(0), prefetch_hit_count(0)
+{
+}
+
+void BlockCache::initialize(size_t block_bytes, size_t capacity_blocks)
+{
+    block_size = block_bytes;
+    capacity = block_bytes > 0 ? capacity_blocks : 0;
+    recency_target = 0;
+    // One spare block so the frames can start on a block_size boundary, as direct
+    // I/O needs when dirty frames are written back from here.
+    arena.assign(capacity > 0 ? (capacity + 1) * block_size : 0, 0);
+    frames = arena.data();
+    if (capacity > 0)
+    {
+        frames += (block_size - (uintptr_t)frames % block_size) % block_size;
+    }
+    free_frames.clear();
+    for (size_t frame = capacity; frame > 0; --frame)
+    {
+        free_frames.push_back(frame - 1);
+    }
+    for (list<size_t>& entries_list : lists)
+    {
+        entries_list.clear();
+    }
+    entries.clear();
+    dirty_blocks.clear();
+    last_block = SIZE_MAX;
+    hit_count = 0;
+    miss_count = 0;
+    eviction_count = 0;
+    prefetch_count = 0;
+    prefetch_hit_count = 0;
+}
+
+// Evicts a resident entry's data, writing it back first when it is dirty.
+void BlockCache::releaseFrame(size_t block, Entry& entry)
+{
+    if (entry.dirty)
+    {
+        if (write_back)
+        {
+            write_back(block, frames + entry.frame * block_size);
+        }
+        dirty_blocks.erase(block);
+        entry.dirty = false;
+    }
+    free_frames.push_back(entry.frame);
+    entry.frame = NO_FRAME;
+    eviction_count++;
+}
+
+// Moves an entry to the front of target. Entering a ghost list gives up its frame.
+void BlockCache::moveTo(size_t block, Entry& entry, ListId target)
+{
+    lists[entry.home].erase(entry.position);
+    lists[target].push_front(block);
+    entry.position = lists[target].begin();
+    entry.home = target;
+    if ((target == RECENT_GHOST || target == FREQUENT_GHOST) && entry.frame != NO_FRAME)
+    {
+        releaseFrame(block, entry);
+    }
+}
+
+void BlockCache::dropLru(ListId list_id)
+{
+    if (lists[list_id].empty())
+    {
+        return;
+    }
+    size_t block = lists[list_id].back();
+    auto it = entries.find(block);
+    if (it->second.frame != NO_FRAME)
+    {
+        releaseFrame(block, it->second);
+    }
+    lists[list_id].pop_back();
+    entries.erase(it);
+}
+
+// Frees one frame, taking it from the recency list while that list is over its target.
+void BlockCache::replace(bool ghost_in_frequent)
+{
+    size_t recent = lists[RECENT].size();
+    bool from_recent = recent > 0 && (recent > recency_target || (ghost_in_frequent && recent == recency_target));
+    if (lists[FREQUENT].empty())
+    {
+        from_recent = true;
+    }
+    ListId source = from_recent ? RECENT : FREQUENT;
+    if (lists[source].empty())
+    {
+        return;
+    }
+    size_t block = lists[source].back();
+    moveTo(block, entries[block], from_recent ? RECENT_GHOST : FREQUENT_GHOST);
+}
+
+const char* BlockCache::find(size_t block)
+{
+    if (capacity == 0)
+    {
+        return nullptr;
+    }
+    auto it = entries.find(block);
+    if (it == entries.end() || it->second.frame == NO_FRAME)
+    {
+        return nullptr;
+    }
+    hit_count++;
+    if (block == last_block)
+    {
+        return frames + it->second.frame * block_size;
+    }
+    last_block = block;
+    if (it->second.prefetched)
+    {
+        it->second.prefetched = false;
+        prefetch_hit_count++;
+        moveTo(block, it->second, RECENT);
+    }
+    else
+    {
+        moveTo(block, it->second, FREQUENT);
+    }
+    return frames + it->second.frame * block_size;
+}
+
+bool BlockCache::contains(size_t block) const
+{
+    auto it = entries.find(block);
+    return it != entries.end() && it->second.frame != NO_FRAME;
+}
+
+void BlockCache::insert(size_t block, const char* data)
+{
+    if (capacity == 0)
+    {
+        return;
+    }
+    miss_count++;
+    last_block = block;
+    if (contains(block))
+    {
+        return;
+    }
+    store(block, data).prefetched = false;
+}
+
+void BlockCache::insertDirty(size_t block, const char* data)
+{
+    if (capacity == 0)
+    {
+        return;
+    }
+    Entry& entry = store(block, data);
+    entry.prefetched = false;
+    entry.dirty = true;
+    dirty_blocks.insert(block);
+}
+
+void BlockCache::prefetch(size_t block, const char* data)
+{
+    if (capacity == 0 || contains(block))
+    {
+        return;
+    }
+    prefetch_count++;
+    store(block, data).prefetched = true;
+}
+
+// Places a block in a frame, following ARC's rules for new keys and ghost hits.
+BlockCache::Entry& BlockCache::store(size_t block, const char* data)
+{
+    auto it = entries.find(block);
+    if (it != entries.end() && it->second.frame != NO_FRAME)
+    {
+        memcpy(frames + it->second.frame * block_size, data, block_size);
+        return it->second;
+    }
+
+    if (it != entries.end())
+    {
+        // A ghost hit means that side of the cache was too small: grow its share.
+        size_t recent_ghosts = lists[RECENT_GHOST].size();
+        size_t frequent_ghosts = lists[FREQUENT_GHOST].size();
+        bool ghost_in_frequent = it->second.home == FREQUENT_GHOST;
+        if (ghost_in_frequent)
+        {
+            size_t delta = max(recent_ghosts / max(frequent_ghosts, (size_t)1), (size_t)1);
+            recency_target = recency_target > delta ? recency_target - delta : 0;
+        }
+        else
+        {
+            size_t delta = max(frequent_ghosts / max(recent_ghosts, (size_t)1), (size_t)1);
+            recency_target = min(capacity, recency_target + delta);
+        }
+        if (free_frames.empty())
+        {
+            replace(ghost_in_frequent);
+        }
+        moveTo(block, it->second, FREQUENT);
+    }
+    else
+    {
+        size_t recent_side = lists[RECENT].size() + lists[RECENT_GHOST].size();
+        size_t total = recent_side + lists[FREQUENT].size() + lists[FREQUENT_GHOST].size();
+        if (recent_side >= capacity)
+        {
+            if (lists[RECENT].size() < capacity)
+            {
+                dropLru(RECENT_GHOST);
+            }
+            else
+            {
+                dropLru(RECENT);
+            }
+        }
+        else if (total >= 2 * capacity)
+        {
+            dropLru(FREQUENT_GHOST);
+        }
+        if (free_frames.empty())
+        {
+            replace(false);
+        }
+        lists[RECENT].push_front(block);
+        it = entries.emplace(block, Entry{RECENT, NO_FRAME, lists[RECENT].begin(), false, false}).first;
+    }
+
+    it->second.frame = free_frames.back();
+    free_frames.pop_back();
+    memcpy(frames + it->second.frame * block_size, data, block_size);
+    return it->second;
+}
+
+bool BlockCache::update(size_t block, size_t offset, const char* data, size_t length, bool dirty)
+{
+    auto it = entries.find(block);
+    if (it == entries.end() || it->second.frame == NO_FRAME || offset >= block_size)
+    {
+        return false;
+    }
+    memcpy(frames + it->second.frame * block_size + offset, data, min(length, block_size - offset));
+    if (dirty)
+    {
+        it->second.dirty = true;
+        dirty_blocks.insert(block);
+    }
+    return true;
+}
+
+void BlockCache::setWriteBack(function<void(size_t block, const char* data)> writer)
+{
+    write_back = writer;
+}
+
+const char* BlockCache::peek(size_t block) const
+{
+    auto it = entries.find(block);
+    if (it == entries.end() || it->second.frame == NO_FRAME)
+    {
+        return nullptr;
+    }
+    return frames + it->second.frame * block_size;
+}
+
+void BlockCache::markClean(size_t block)
+{
+    auto it = entries.find(block);
+    if (it != entries.end())
+    {
+        it->second.dirty = false;
+    }
+    dirty_blocks.erase(block);
+}
+
+void BlockCache::invalidate(size_t first, size_t count)
+{
+    auto erase = [&](unordered_map<size_t, Entry>::iterator it)
+    {
+        lists[it->second.home].erase(it->second.position);
+        dirty_blocks.erase(it->first);
+        if (it->second.frame != NO_FRAME)
+        {
+            free_frames.push_back(it->second.frame);
+        }
+        return entries.erase(it);
+    };
+
+    if (count < entries.size())
+    {
+        for (size_t block = first; block < first + count; ++block)
+        {
+            auto it = entries.find(block);
+            if (it != entries.end())
+            {
+                erase(it);
+            }
+        }
+        return;
+    }
+    for (auto it = entries.begin(); it != entries.end();)
+    {
+        if (it->first >= first && it->first < first + count)
+        {
+            it = erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+BlockCacheStats BlockCache::stats() const
+{
+    BlockCacheStats result;
+    result.capacity_blocks = capacity;
+    result.resident_blocks = capacity - free_frames.size();
+    result.hits = hit_count;
+    result.misses = miss_count;
+    result.evictions = eviction_count;
+    result.recency_target = recency_target;
+    result.prefetched_blocks = prefetch_count;
+    result.prefetch_hits = prefetch_hit_count;
+    result.dirty_blocks = dirty_blocks.size();
+    result.written_back_blocks = 0;
+    result.write_back_runs = 0;
+    return result;
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <list>
+#include <set>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+struct BlockCacheStats {
+    uint64_t capacity_blocks;
+    uint64_t resident_blocks;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t recency_target;    // ARC's target size for the recently-used list, in blocks
+    uint64_t prefetched_blocks;
+    uint64_t prefetch_hits;     // Prefetched blocks later read
+    uint64_t dirty_blocks;      // Write-back: blocks newer in memory than on disk
+    uint64_t written_back_blocks;
+    uint64_t write_back_runs;   // Writes issued for them, adjacent blocks merged
+};
+
+// Copies of data blocks keyed by block index, evicted with ARC (Adaptive Replacement
+// Cache). Blocks seen once live in a recency list, blocks seen again move to a
+// frequency list, and ghost lists of recently evicted keys steer how much room each
+// side gets. A long scan only cycles the recency list, so it cannot flush hot
+// blocks. Block data sits in one arena of fixed frames sized at initialize, each
+// aligned to the block size.
+class BlockCache
+{
+private:
+    enum ListId { RECENT = 0, FREQUENT = 1, RECENT_GHOST = 2, FREQUENT_GHOST = 3 };
+
+    struct Entry {
+        ListId home;
+        size_t frame;
+        list<size_t>::iterator position;
+        bool prefetched;                // Read ahead and not used yet
+        bool dirty;
+    };
+
+    size_t block_size;
+    size_t capacity;
+    size_t recency_target;
+    vector<char> arena;
+    char* frames;                       // Start of frame 0 in arena, aligned to block_size
+    vector<size_t> free_frames;
+    list<size_t> lists[4];              // Front is most recently used
+    size_t last_block;                  // Block of the latest lookup or insert
+    set<size_t> dirty_blocks;
+    function<void(size_t, const char*)> write_back;
+    unordered_map<size_t, Entry> entries;
+    uint64_t hit_count;
+    uint64_t miss_count;
+    uint64_t eviction_count;
+    uint64_t prefetch_count;
+    uint64_t prefetch_hit_count;
+
+    void moveTo(size_t block, Entry& entry, ListId target);
+    void dropLru(ListId list_id);
+    void replace(bool ghost_in_frequent);
+    Entry& store(size_t block, const char* data);
+    void releaseFrame(size_t block, Entry& entry);
+
+public:
+    BlockCache();
+    // capacity_blocks of 0 disables the cache.
+    void initialize(size_t block_size, size_t capacity_blocks);
+
+    // Returns the cached block and marks it as used again, or nullptr when absent.
+    // Looking up the block of the previous lookup again is the same use (a block
+    // straddling two small sequential reads), so it does not count as a repeat.
+    const char* find(size_t block);
+    bool contains(size_t block) const;
+    // Stores a block just read from disk after a miss, and counts the miss.
+    void insert(size_t block, const char* data);
+    // Stores a block read ahead of use. Its first hit counts as its first use, so a
+    // streamed file stays in the recency list.
+    void prefetch(size_t block, const char* data);
+    // Patches a resident block and returns whether it was resident. Without dirty the
+    // bytes are already on disk; with it they must be written back later.
+    bool update(size_t block, size_t offset, const char* data, size_t length, bool dirty = false);
+    // Stores a whole block that is newer than its copy on disk.
+    void insertDirty(size_t block, const char* data);
+    // Called with each dirty block about to be evicted, so it can be written first.
+    void setWriteBack(function<void(size_t block, const char* data)> writer);
+    const set<size_t>& dirtyBlocks() const
+    {
+        return dirty_blocks;
+    }
+    // Resident data without counting a use, or nullptr.
+    const char* peek(size_t block) const;
+    void markClean(size_t block);
+    // Forgets [first, first + count), including ghost entries. Dirty data is dropped.
+    void invalidate(size_t first, size_t count);
+
+    bool enabled() const {
+        return capacity > 0;
+    }
+    BlockCacheStats stats() const;
+};
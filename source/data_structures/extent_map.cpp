@@ -0,0 +1,208 @@
+#include "extent_map.hpp"
+#include <algorithm>
+#include <iterator>
+
+ExtentMap::ExtentMap() : block_count(0)
+{
+}
+
+void ExtentMap::append(size_t start, size_t length)
+{
+    if (length == 0)
+    {
+        return;
+    }
+    if (!extents.empty() && endBlock() == start)
+    {
+        extents.back().length += length;
+    }
+    else
+    {
+        extents.push_back({logicalEnd(), start, length});
+    }
+    block_count += length;
+}
+
+void ExtentMap::insert(size_t logical, size_t start, size_t length)
+{
+    if (length == 0)
+    {
+        return;
+    }
+    size_t index = lowerBound(logical);
+    block_count += length;
+
+    bool joins_prev = index > 0 && extents[index - 1].logical + extents[index - 1].length == logical &&
+                      extents[index - 1].start + extents[index - 1].length == start;
+    bool joins_next = index < extents.size() && logical + length == extents[index].logical &&
+                      start + length == extents[index].start;
+    if (joins_prev && joins_next)
+    {
+        extents[index - 1].length += length + extents[index].length;
+        extents.erase(extents.begin() + index);
+    }
+    else if (joins_prev)
+    {
+        extents[index - 1].length += length;
+    }
+    else if (joins_next)
+    {
+        extents[index].logical = logical;
+        extents[index].start = start;
+        extents[index].length += length;
+    }
+    else
+    {
+        extents.insert(extents.begin() + index, {logical, start, length});
+    }
+}
+
+vector<Extent> ExtentMap::truncate(size_t new_end)
+{
+    vector<Extent> removed;
+    while (!extents.empty() && logicalEnd() > new_end)
+    {
+        Extent& last = extents.back();
+        size_t keep = (new_end > last.logical) ? new_end - last.logical : 0;
+        removed.push_back({last.logical + keep, last.start + keep, last.length - keep});
+        block_count -= last.length - keep;
+        if (keep == 0)
+        {
+            extents.pop_back();
+        }
+        else
+        {
+            last.length = keep;
+        }
+    }
+    return removed;
+}
+
+vector<Extent> ExtentMap::punch(size_t first, size_t count)
+{
+    vector<Extent> removed;
+    vector<Extent> kept;
+    size_t last = first + count;
+    for (const Extent& extent : extents)
+    {
+        size_t begin = extent.logical;
+        size_t end = extent.logical + extent.length;
+        if (end <= first || begin >= last)
+        {
+            kept.push_back(extent);
+            continue;
+        }
+        if (begin < first)
+        {
+            kept.push_back({begin, extent.start, first - begin});
+        }
+        size_t cut_begin = max(begin, first);
+        size_t cut_end = min(end, last);
+        removed.push_back({cut_begin, extent.start + (cut_begin - begin), cut_end - cut_begin});
+        block_count -= cut_end - cut_begin;
+        if (end > last)
+        {
+            kept.push_back({last, extent.start + (last - begin), end - last});
+        }
+    }
+    extents.swap(kept);
+    return removed;
+}
+
+void ExtentMap::clear()
+{
+    extents.clear();
+    block_count = 0;
+}
+
+int ExtentMap::find(size_t logical_block) const
+{
+    size_t index = lowerBound(logical_block);
+    if (index == extents.size() || extents[index].logical > logical_block)
+    {
+        return -1;
+    }
+    return (int)index;
+}
+
+size_t ExtentMap::lowerBound(size_t logical_block) const
+{
+    auto it = upper_bound(extents.begin(), extents.end(), logical_block,
+        [](size_t block, const Extent& extent) { return block < extent.logical; });
+    if (it != extents.begin() && prev(it)->logical + prev(it)->length > logical_block)
+    {
+        --it;
+    }
+    return it - extents.begin();
+}
+
+int64_t ExtentMap::physicalBlock(size_t logical_block) const
+{
+    int index = find(logical_block);
+    if (index < 0)
+    {
+        return -1;
+    }
+    const Extent& extent = extents[index];
+    return extent.start + (logical_block - extent.logical);
+}
+
+vector<Extent> ExtentMap::holes(size_t first, size_t count) const
+{
+    vector<Extent> result;
+    size_t pos = first;
+    size_t last = first + count;
+    for (size_t i = lowerBound(first); i < extents.size() && pos < last; ++i)
+    {
+        if (extents[i].logical > pos)
+        {
+            result.push_back({pos, 0, min((size_t)extents[i].logical, last) - pos});
+        }
+        pos = max(pos, (size_t)(extents[i].logical + extents[i].length));
+    }
+    if (pos < last)
+    {
+        result.push_back({pos, 0, last - pos});
+    }
+    return result;
+}
+
+ExtentMap ExtentMap::relocated(size_t start) const
+{
+    ExtentMap result;
+    for (const Extent& extent : extents)
+    {
+        result.insert(extent.logical, start, extent.length);
+        start += extent.length;
+    }
+    return result;
+}
+
+bool ExtentMap::isContiguous() const
+{
+    for (size_t i = 1; i < extents.size(); ++i)
+    {
+        if (extents[i].start != extents[i - 1].start + extents[i - 1].length)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ExtentMap::operator==(const ExtentMap& other) const
+{
+    if (block_count != other.block_count || extents.size() != other.extents.size())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < extents.size(); ++i)
+    {
+        if (extents[i].logical != other.extents[i].logical || extents[i].start != other.extents[i].start ||
+            extents[i].length != other.extents[i].length)
+        {
+            return false;
+        }
+    }
+    return true;
+}
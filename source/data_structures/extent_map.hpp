@@ -0,0 +1,81 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+struct Extent {
+    uint64_t logical;   // First file block covered by this extent
+    uint64_t start;     // First physical block
+    uint64_t length;
+};
+
+// Maps a file's logical blocks onto physical runs. Extents are kept in logical
+// order, so a lookup is a binary search on the logical start. Logical blocks not
+// covered by any extent are holes: they have no storage and read as zeroes.
+class ExtentMap 
+{
+private:
+    vector<Extent> extents;
+    size_t block_count;
+
+public:
+    ExtentMap();
+
+    // Appends length blocks starting at physical block start, merging with the last extent when adjacent.
+    void append(size_t start, size_t length);
+    // Maps the unmapped logical range [logical, logical + length) onto physical blocks from start.
+    void insert(size_t logical, size_t start, size_t length);
+    // Drops every block past logical block new_end and returns the physical runs that were removed.
+    vector<Extent> truncate(size_t new_end);
+    // Unmaps [first, first + count), leaving a hole, and returns the physical runs that were removed.
+    vector<Extent> punch(size_t first, size_t count);
+    void clear();
+
+    // Index of the extent holding logical_block, or -1 when it lies in a hole or past the end.
+    int find(size_t logical_block) const;
+    // Index of the first extent ending past logical_block, or extentCount() when there is none.
+    size_t lowerBound(size_t logical_block) const;
+    // Physical block backing logical_block, or -1 when it lies in a hole or past the end.
+    int64_t physicalBlock(size_t logical_block) const;
+    // Unmapped runs within [first, first + count), as extents with no physical start.
+    vector<Extent> holes(size_t first, size_t count) const;
+    // The same logical layout with the physical runs laid out back to back from start.
+    ExtentMap relocated(size_t start) const;
+
+    bool empty() const {
+        return extents.empty();
+    }
+    // Blocks actually backed by storage.
+    size_t blockCount() const {
+        return block_count;
+    }
+    // One past the last mapped logical block.
+    size_t logicalEnd() const {
+        return extents.empty() ? 0 : extents.back().logical + extents.back().length;
+    }
+    bool hasHoles() const {
+        return logicalEnd() != block_count;
+    }
+    size_t extentCount() const {
+        return extents.size();
+    }
+    // True when the mapped blocks form one physical run, whatever holes lie between them.
+    bool isContiguous() const;
+    size_t firstBlock() const {
+        return extents.front().start;
+    }
+    // One past the last physical block of the final extent.
+    size_t endBlock() const {
+        return extents.back().start + extents.back().length;
+    }
+    const vector<Extent>& list() const {
+        return extents;
+    }
+
+    bool operator==(const ExtentMap& other) const;
+    bool operator!=(const ExtentMap& other) const {
+        return !(*this == other);
+    }
+};
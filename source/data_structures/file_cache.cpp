@@ -0,0 +1,71 @@
+#include "file_cache.hpp"
+
+FileCache::FileCache() : budget(0), max_file_bytes(0), used(0), hit_count(0), miss_count(0), eviction_count(0)
+{
+}
+
+void FileCache::initialize(size_t budget_bytes, size_t max_bytes)
+{
+    budget = budget_bytes;
+    max_file_bytes = max_bytes;
+    used = 0;
+    lru.clear();
+    entries.clear();
+    hit_count = 0;
+    miss_count = 0;
+    eviction_count = 0;
+}
+
+const string* FileCache::find(const FSTreeNode* node, uint64_t version)
+{
+    auto it = entries.find(node);
+    if (it == entries.end() || it->second.version != version)
+    {
+        miss_count++;
+        return nullptr;
+    }
+    hit_count++;
+    lru.splice(lru.begin(), lru, it->second.position);
+    return &it->second.content;
+}
+
+void FileCache::insert(const FSTreeNode* node, uint64_t version, const char* data, size_t size)
+{
+    if (!eligible(size))
+    {
+        return;
+    }
+    erase(node);
+    while (used + size > budget && !lru.empty())
+    {
+        erase(lru.back());
+        eviction_count++;
+    }
+    lru.push_front(node);
+    entries.emplace(node, Entry{version, string(data, size), lru.begin()});
+    used += size;
+}
+
+void FileCache::erase(const FSTreeNode* node)
+{
+    auto it = entries.find(node);
+    if (it == entries.end())
+    {
+        return;
+    }
+    used -= it->second.content.size();
+    lru.erase(it->second.position);
+    entries.erase(it);
+}
+
+FileCacheStats FileCache::stats() const
+{
+    FileCacheStats result;
+    result.budget_bytes = budget;
+    result.cached_bytes = used;
+    result.cached_files = entries.size();
+    result.hits = hit_count;
+    result.misses = miss_count;
+    result.evictions = eviction_count;
+    return result;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+struct FSTreeNode;
+
+struct FileCacheStats {
+    uint64_t budget_bytes;
+    uint64_t cached_bytes;
+    uint64_t cached_files;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+// Whole contents of small files, keyed by the file's node (its in-memory inode) and
+// the version it had when read. Any change to a file gives it a new version, so a
+// stale copy is never returned; callers still erase entries of changed files to get
+// the memory back. Least recently read files are evicted to stay within the budget.
+class FileCache
+{
+private:
+    struct Entry {
+        uint64_t version;
+        string content;
+        list<const FSTreeNode*>::iterator position;
+    };
+
+    size_t budget;
+    size_t max_file_bytes;
+    size_t used;
+    list<const FSTreeNode*> lru;                // Front is most recently read
+    unordered_map<const FSTreeNode*, Entry> entries;
+    uint64_t hit_count;
+    uint64_t miss_count;
+    uint64_t eviction_count;
+
+public:
+    FileCache();
+    // budget_bytes of 0 disables the cache; larger files than max_bytes are never kept.
+    void initialize(size_t budget_bytes, size_t max_bytes);
+
+    bool eligible(size_t size) const
+    {
+        return budget > 0 && size <= max_file_bytes && size <= budget;
+    }
+    // Returns the cached content for this version of the file, or nullptr.
+    const string* find(const FSTreeNode* node, uint64_t version);
+    void insert(const FSTreeNode* node, uint64_t version, const char* data, size_t size);
+    void erase(const FSTreeNode* node);
+    FileCacheStats stats() const;
+};
@@ -0,0 +1,118 @@
+#include "fragment_allocator.hpp"
+
+static size_t count_bits(uint64_t value)
+{
+    size_t count = 0;
+    while (value)
+    {
+        value &= value - 1;
+        count++;
+    }
+    return count;
+}
+
+FragmentAllocator::FragmentAllocator() : slots_per_block(0), used_slots(0), fragment_count(0), change_count(0)
+{
+}
+
+void FragmentAllocator::initialize(size_t slots)
+{
+    slots_per_block = (slots > MAX_SLOTS_PER_BLOCK) ? MAX_SLOTS_PER_BLOCK : slots;
+    block_slots.clear();
+    used_slots = 0;
+    fragment_count = 0;
+}
+
+uint64_t FragmentAllocator::slotMask(size_t first_slot, size_t slot_count)
+{
+    uint64_t run = (slot_count >= 64) ? ~0ULL : ((1ULL << slot_count) - 1);
+    return run << first_slot;
+}
+
+bool FragmentAllocator::allocate(size_t slot_count, FragmentRef& ref, int64_t exclude_block)
+{
+    if (slot_count == 0 || slot_count > slots_per_block)
+    {
+        return false;
+    }
+
+    bool found = false;
+    size_t best_used = 0;
+    for (const auto& item : block_slots)
+    {
+        if ((int64_t)item.first == exclude_block)
+        {
+            continue;
+        }
+        size_t used = count_bits(item.second);
+        if (found && used <= best_used)
+        {
+            continue;
+        }
+        for (size_t slot = 0; slot + slot_count <= slots_per_block; ++slot)
+        {
+            if ((item.second & slotMask(slot, slot_count)) == 0)
+            {
+                ref = {item.first, (uint32_t)slot, (uint32_t)slot_count};
+                best_used = used;
+                found = true;
+                break;
+            }
+        }
+    }
+
+    if (found)
+    {
+        mark(ref);
+    }
+    return found;
+}
+
+void FragmentAllocator::addBlock(size_t block)
+{
+    block_slots.emplace(block, 0);
+    change_count++;
+}
+
+void FragmentAllocator::mark(const FragmentRef& ref)
+{
+    block_slots[ref.block] |= slotMask(ref.first_slot, ref.slot_count);
+    used_slots += ref.slot_count;
+    fragment_count++;
+    change_count++;
+}
+
+bool FragmentAllocator::release(const FragmentRef& ref)
+{
+    auto it = block_slots.find(ref.block);
+    if (it == block_slots.end())
+    {
+        return false;
+    }
+    it->second &= ~slotMask(ref.first_slot, ref.slot_count);
+    used_slots -= ref.slot_count;
+    fragment_count--;
+    change_count++;
+    if (it->second == 0)
+    {
+        block_slots.erase(it);
+        return true;
+    }
+    return false;
+}
+
+int64_t FragmentAllocator::emptiestBlock() const
+{
+    int64_t best = -1;
+    size_t best_used = 0;
+    for (const auto& item : block_slots)
+    {
+        size_t used = count_bits(item.second);
+        if (best == -1 || used < best_used)
+        {
+            best = item.first;
+            best_used = used;
+        }
+    }
+    return best;
+}
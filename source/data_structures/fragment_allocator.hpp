@@ -0,0 +1,64 @@
+#pragma once
+#include <map>
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+// A run of consecutive fragment slots inside one data block.
+struct FragmentRef {
+    uint64_t block;
+    uint32_t first_slot;
+    uint32_t slot_count;    // 0 when the file has no packed tail
+};
+
+// Sub-allocates data blocks into fixed-size slots so small files and file tails
+// can share blocks. Only blocks holding at least one fragment are tracked; the
+// caller takes blocks from and returns them to the FreeSpaceBitmap.
+class FragmentAllocator 
+{
+public:
+    static const size_t MAX_SLOTS_PER_BLOCK = 64;
+
+private:
+    size_t slots_per_block;
+    map<size_t, uint64_t> block_slots;     // Fragment block -> bitmask of used slots
+    size_t used_slots;
+    size_t fragment_count;
+    uint64_t change_count;
+
+    static uint64_t slotMask(size_t first_slot, size_t slot_count);
+
+public:
+    FragmentAllocator();
+    void initialize(size_t slots_per_block);
+
+    // Places slot_count slots in an existing fragment block, preferring the fullest
+    // block with room. Returns false when none has a free run long enough.
+    bool allocate(size_t slot_count, FragmentRef& ref, int64_t exclude_block = -1);
+    // Starts tracking a fresh, empty block as a fragment block.
+    void addBlock(size_t block);
+    // Records an existing fragment, adding its block if needed (used at load time).
+    void mark(const FragmentRef& ref);
+    // Frees the fragment's slots. Returns true when its block became empty and is no longer tracked.
+    bool release(const FragmentRef& ref);
+
+    // Fragment block with the fewest used slots, or -1 when there is none.
+    int64_t emptiestBlock() const;
+
+    size_t slotsPerBlock() const {
+        return slots_per_block;
+    }
+    size_t blockCount() const {
+        return block_slots.size();
+    }
+    size_t usedSlots() const {
+        return used_slots;
+    }
+    size_t fragmentCount() const {
+        return fragment_count;
+    }
+    uint64_t generation() const {
+        return change_count;
+    }
+};
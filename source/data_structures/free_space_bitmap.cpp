@@ -1,62 +1,183 @@
 #include "free_space_bitmap.hpp"
+#include <cstring>
+
+static int log2_bucket(size_t length)
+{
+    int bucket = 0;
+    while (length >>= 1) bucket++;
+    return bucket;
+}
+
+FreeSpaceBitmap::FreeSpaceBitmap() : total_blocks(0), change_count(0), free_blocks(0)
+{
+    memset(run_histogram, 0, sizeof(run_histogram));
+}
 
 void FreeSpaceBitmap::initialize(size_t num_blocks) 
 {
-    bitmap.resize(num_blocks, false); 
+    bitmap.assign(num_blocks, false); 
     total_blocks = num_blocks;
+    free_blocks = 0;
+    free_runs.clear();
+    run_length_counts.clear();
+    memset(run_histogram, 0, sizeof(run_histogram));
+    if (num_blocks > 0)
+    {
+        addRun(0, num_blocks);
+        free_blocks = num_blocks;
+    }
 }
 
-int FreeSpaceBitmap::findFreeBlocks(size_t num_blocks_needed) 
+// Appends free blocks up to num_blocks; existing blocks keep their state.
+void FreeSpaceBitmap::grow(size_t num_blocks)
 {
-    size_t consecutive_free = 0;
-    for (size_t i = 0; i < total_blocks; ++i) 
+    if (num_blocks <= total_blocks)
     {
-        if (!bitmap[i]) 
+        return;
+    }
+    size_t old_blocks = total_blocks;
+    bitmap.resize(num_blocks, false);
+    total_blocks = num_blocks;
+    markFree(old_blocks, num_blocks);
+    free_blocks += num_blocks - old_blocks;
+    change_count++;
+}
+
+void FreeSpaceBitmap::addRun(size_t start, size_t length)
+{
+    free_runs[start] = length;
+    run_length_counts[length]++;
+    run_histogram[log2_bucket(length)]++;
+}
+
+void FreeSpaceBitmap::eraseRun(map<size_t, size_t>::iterator it)
+{
+    size_t length = it->second;
+    auto count_it = run_length_counts.find(length);
+    if (--count_it->second == 0)
+    {
+        run_length_counts.erase(count_it);
+    }
+    run_histogram[log2_bucket(length)]--;
+    free_runs.erase(it);
+}
+
+// [start, end) has just become used: trim or split every free run overlapping it.
+void FreeSpaceBitmap::markUsed(size_t start, size_t end)
+{
+    auto it = free_runs.upper_bound(start);
+    if (it != free_runs.begin())
+    {
+        --it;
+    }
+    while (it != free_runs.end() && it->first < end)
+    {
+        size_t run_start = it->first;
+        size_t run_end = run_start + it->second;
+        auto next = std::next(it);
+        if (run_end > start)
         {
-            consecutive_free++;
-            if (consecutive_free == num_blocks_needed) 
-            {
-                return i - num_blocks_needed + 1; 
-            }
-        } 
-        else 
+            eraseRun(it);
+            if (run_start < start) addRun(run_start, start - run_start);
+            if (run_end > end) addRun(end, run_end - end);
+        }
+        it = next;
+    }
+}
+
+// [start, end) has just become free: merge it with the runs touching either side.
+void FreeSpaceBitmap::markFree(size_t start, size_t end)
+{
+    auto right = free_runs.find(end);
+    if (right != free_runs.end())
+    {
+        end += right->second;
+        eraseRun(right);
+    }
+
+    auto left = free_runs.lower_bound(start);
+    if (left != free_runs.begin())
+    {
+        --left;
+        if (left->first + left->second == start)
         {
-            consecutive_free = 0; 
+            start = left->first;
+            eraseRun(left);
         }
     }
-    return -1; 
+    addRun(start, end - start);
 }
 
-void FreeSpaceBitmap::setBlock(size_t block_index) 
+int64_t FreeSpaceBitmap::findFreeBlocks(size_t num_blocks_needed) 
 {
-    if (block_index < total_blocks) 
+    if (num_blocks_needed == 0 || num_blocks_needed > largestFreeExtent())
     {
-        bitmap[block_index] = true;
+        return -1;
+    }
+    for (const auto& run : free_runs) 
+    {
+        if (run.second >= num_blocks_needed) 
+        {
+            return run.first; 
+        }
     }
+    return -1; 
 }
 
+void FreeSpaceBitmap::setBlock(size_t block_index) 
+{
+    setBlocks(block_index, 1);
+}
 
 void FreeSpaceBitmap::setBlocks(size_t start_index, size_t num_blocks) 
 {
-    for (size_t i = 0; i < num_blocks; ++i) 
+    size_t end = start_index + num_blocks;
+    if (end > total_blocks) end = total_blocks;
+
+    size_t flipped = 0;
+    for (size_t i = start_index; i < end; ++i) 
+    {
+        if (!bitmap[i])
+        {
+            bitmap[i] = true;
+            flipped++;
+        }
+    }
+    if (flipped > 0)
     {
-        setBlock(start_index + i);
+        markUsed(start_index, end);
+        free_blocks -= flipped;
+        change_count++;
     }
 }
 
 void FreeSpaceBitmap::freeBlock(size_t block_index) 
 {
-    if (block_index < total_blocks) 
-    {
-        bitmap[block_index] = false;
-    }
+    freeBlocks(block_index, 1);
 }
 
 void FreeSpaceBitmap::freeBlocks(size_t start_index, size_t num_blocks) 
 {
-    for (size_t i = 0; i < num_blocks; ++i) 
+    size_t end = start_index + num_blocks;
+    if (end > total_blocks) end = total_blocks;
+
+    size_t i = start_index;
+    while (i < end)
     {
-        freeBlock(start_index + i);
+        if (!bitmap[i])
+        {
+            i++;
+            continue;
+        }
+        size_t run_start = i;
+        while (i < end && bitmap[i])
+        {
+            bitmap[i] = false;
+            i++;
+        }
+        markFree(run_start, i);
+        free_blocks += i - run_start;
+        change_count++;
     }
 }
 
@@ -67,4 +188,13 @@ bool FreeSpaceBitmap::isBlockSet(size_t block_index) const
         return bitmap[block_index];
     }
     return false;
-}
\ No newline at end of file
+}
+
+double FreeSpaceBitmap::fragmentation() const
+{
+    if (free_blocks == 0)
+    {
+        return 0.0;
+    }
+    return 100.0 * (1.0 - (double)largestFreeExtent() / (double)free_blocks);
+}
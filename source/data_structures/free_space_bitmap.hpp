@@ -1,19 +1,55 @@
 #pragma once
 #include <vector>
+#include <map>
 #include <cstddef> 
+#include <cstdint>
 
 using namespace std;
 
+struct FreeSpaceStats {
+    uint64_t free_blocks;
+    uint64_t free_extents;
+    uint64_t largest_free_extent;
+    uint64_t reserved_blocks;           // Promised to buffered writes, not yet placed
+    uint64_t pending_bytes;             // Buffered write data awaiting flush
+    uint64_t append_slack_blocks;       // Capacity held past EOF by appended files
+    uint64_t large_region_blocks;       // Blocks set aside for large files at format
+    uint64_t large_free_blocks;         // Free blocks in that region, counted in whole large blocks
+    uint64_t fragment_blocks;           // Blocks shared by packed small files and tails
+    uint64_t packed_tails;
+    uint64_t tail_bytes_reclaimed;      // Whole blocks the packed tails would otherwise occupy, less fragment_blocks
+    uint64_t punch_pending_blocks;      // Freed blocks not yet punched out of the host file
+    uint64_t punched_blocks;            // Blocks punched out of the host file since startup
+    uint64_t free_run_histogram[64];    // Bucket i: free runs of length [2^i, 2^(i+1))
+};
+
 class FreeSpaceBitmap 
 {
+public:
+    static const int HISTOGRAM_BUCKETS = 64;
+
 private:
     vector<bool> bitmap;
     size_t total_blocks;
+    uint64_t change_count;
+
+    // Free runs are indexed by start block and counted by length so fragmentation
+    // metrics are maintained on every set/free instead of rescanning the bitmap.
+    map<size_t, size_t> free_runs;
+    map<size_t, size_t> run_length_counts;
+    size_t run_histogram[HISTOGRAM_BUCKETS];
+    size_t free_blocks;
+
+    void addRun(size_t start, size_t length);
+    void eraseRun(map<size_t, size_t>::iterator it);
+    void markUsed(size_t start, size_t end);
+    void markFree(size_t start, size_t end);
 
 public:
-    FreeSpaceBitmap() : total_blocks(0) {}
+    FreeSpaceBitmap();
     void initialize(size_t num_blocks);
-    int findFreeBlocks(size_t num_blocks_needed);
+    void grow(size_t num_blocks);
+    int64_t findFreeBlocks(size_t num_blocks_needed);
     void setBlock(size_t block_index);
     void setBlocks(size_t start_index, size_t num_blocks);
     void freeBlock(size_t block_index);
@@ -22,4 +58,24 @@ public:
     size_t size() const {
         return total_blocks;
     }
-};
\ No newline at end of file
+    // Bumped whenever a block flips state; lets background tasks skip work when the layout is unchanged.
+    uint64_t generation() const {
+        return change_count;
+    }
+
+    size_t freeBlockCount() const {
+        return free_blocks;
+    }
+    size_t freeExtentCount() const {
+        return free_runs.size();
+    }
+    size_t largestFreeExtent() const {
+        return run_length_counts.empty() ? 0 : run_length_counts.rbegin()->first;
+    }
+    // Bucket i counts free runs whose length lies in [2^i, 2^(i+1)).
+    const size_t* freeRunHistogram() const {
+        return run_histogram;
+    }
+    // Share of free space that lies outside the largest free run (0.0 - 100.0).
+    double fragmentation() const;
+};
@@ -2,21 +2,82 @@
 
 #include "../include/odf_types.hpp"
 #include "child_avl_tree.hpp"
+#include "extent_map.hpp"
+#include "fragment_allocator.hpp"
 #include <string>  
 #include <vector>  
 
 using namespace std;
 
+// An entry with start 0 is a hole of length blocks; block 0 always holds the header.
+struct DiskExtent {
+    uint64_t start;
+    uint64_t length;
+};
+
+// On-disk form of an FSTreeNode: one fixed-size slot in the metadata area. The
+// entry name holds the full path. Files with more extents than fit in one slot
+// continue in RECORD_EXTENTS slots that immediately follow it. Tiny files keep
+// their content in the slot itself (FLAG_INLINE) and own no data blocks; small
+// files and tails may instead live in a shared fragment block (FLAG_TAIL).
+// When the table is full it continues in overflow extents chained through the
+// data area, each starting with a RECORD_CHAIN slot.
+struct FSTreeNode_Disk {
+    static constexpr uint32_t RECORD_EMPTY = 0;
+    static constexpr uint32_t RECORD_NODE = 1;
+    static constexpr uint32_t RECORD_EXTENTS = 2;
+    static constexpr uint32_t RECORD_CHAIN = 3;     // First slot of a metadata overflow extent; extents[0] is the next one
+    static constexpr uint32_t FLAG_INLINE = 1;
+    static constexpr uint32_t FLAG_TAIL = 2;
+    static constexpr int MAX_EXTENTS = 8;
+    static constexpr int INLINE_CAPACITY = 240;
+
+    FileEntry entry;
+    uint32_t record_type;
+    uint32_t extent_count;
+    uint64_t prealloc_blocks;   // Capacity kept by file_allocate even when content shrinks
+    uint32_t flags;
+    uint16_t tail_slot;
+    uint16_t tail_slots;
+    uint64_t tail_block;
+    union {
+        char inline_data[INLINE_CAPACITY];      // First member, so "= {}" zeroes the whole union
+        DiskExtent extents[MAX_EXTENTS];
+    };
+};
+
 struct FSTreeNode {
     FileEntry metadata;
     FSTreeNode* parent;
 
     ChildAVLTree children;
 
-    vector<int> data_blocks;
+    ExtentMap extents;
+    FragmentRef tail;       // Bytes past the last full block, packed into a fragment block
+    size_t prealloc_blocks;
+    uint64_t version;
+
+    // Delayed allocation: content buffered in memory against a block reservation
+    // until it is flushed to freshly placed blocks.
+    bool has_pending;
+    string pending_data;
+    size_t reserved_blocks;
+    uint64_t dirty_since_ms;
+    uint64_t last_append_ms;
+
+    // Inline files: content small enough to live in the metadata record.
+    bool is_inline;
+    string inline_data;
+
+    // Read-ahead: offset a sequential ranged read would start at next, and the
+    // number of blocks fetched past each such read (0 until a stream is seen).
+    size_t read_next;
+    size_t readahead_window;
 
     FSTreeNode(const FileEntry& meta, FSTreeNode* p) : 
-        metadata(meta), parent(p) {
+        metadata(meta), parent(p), tail{0, 0, 0}, prealloc_blocks(0), version(0),
+        has_pending(false), reserved_blocks(0), dirty_since_ms(0), last_append_ms(0),
+        is_inline(false), read_next(0), readahead_window(0) {
     }
 
     bool isDirectory() const 
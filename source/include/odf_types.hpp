@@ -85,14 +85,28 @@ struct OMNIHeader {
     char config_hash[64];       // SHA-256 hash of config file (64 bytes)
     uint64_t config_timestamp;  // Config file timestamp (8 bytes)
     
-    uint32_t user_table_offset; // Byte offset to user table (4 bytes)
+    uint64_t user_table_offset; // Byte offset to user table (8 bytes)
     uint32_t max_users;         // Maximum number of users (4 bytes)
+    uint32_t padding;           // Keeps the following offsets 8-byte aligned (4 bytes)
     
     // Reserved for Phase 2: Delta Vault 
-    uint32_t file_state_storage_offset;  // Offset to file_state_storage area (4 bytes)
-    uint32_t change_log_offset;       // Offset to change log (4 bytes)
+    uint64_t file_state_storage_offset;  // Offset to file_state_storage area (8 bytes)
+    uint64_t change_log_offset;       // Offset to change log (8 bytes)
+
+    uint32_t fragment_size;     // Tail-packing slot size in bytes, 0 if disabled (4 bytes)
+    uint32_t large_block_size;  // Block size of the large-file region in bytes, 0 if none (4 bytes)
+    uint64_t large_region_blocks;  // Length of the large-file region, in blocks (8 bytes)
+    uint64_t large_region_start;   // First block of the large-file region (8 bytes)
+
+    uint64_t bitmap_offset;     // Byte offset of the free-space bitmap; moves when the container grows (8 bytes)
+    uint64_t bitmap_size;       // Bytes reserved for the bitmap, a whole number of blocks (8 bytes)
+    uint64_t data_start_block;  // First block after the header, tables and original bitmap (8 bytes)
+
+    uint64_t metadata_slots;    // Metadata records in the table after the user table (8 bytes)
+    uint64_t metadata_extent_slots;  // Records in each overflow extent, after its link record (8 bytes)
+    uint64_t metadata_chain_start;   // First block of the first overflow extent, 0 if none (8 bytes)
     
-    uint8_t reserved[328];      // Reserved for future use (328 bytes)
+    uint8_t reserved[240];      // Reserved for future use (240 bytes)
 
     // Default constructor
     OMNIHeader() = default;
@@ -147,16 +161,16 @@ struct FileEntry {
     uint64_t created_time;      // Creation timestamp (Unix epoch)
     uint64_t modified_time;     // Last modification timestamp (Unix epoch)
     char owner[32];             // Username of owner
-    uint32_t inode;             // Internal file identifier
-    uint32_t parent_inode;      // Inode of the parent directory
-    uint8_t reserved[43];       // Reserved for future use
+    uint64_t inode;             // Internal file identifier (first data block of a file)
+    uint64_t parent_inode;      // Inode of the parent directory
+    uint8_t reserved[35];       // Reserved for future use
 
     // Default constructor
     FileEntry() = default;
     
     // Constructor
     FileEntry(const std::string& filename, EntryType entry_type, uint64_t file_size, 
-              uint32_t perms, const std::string& file_owner, uint32_t file_inode, uint32_t parent_ino)
+              uint32_t perms, const std::string& file_owner, uint64_t file_inode, uint64_t parent_ino)
         : type(static_cast<uint8_t>(entry_type)), size(file_size), permissions(perms), 
           created_time(0), modified_time(0), inode(file_inode), parent_inode(parent_ino) {
         std::strncpy(name, filename.c_str(), sizeof(name) - 1);
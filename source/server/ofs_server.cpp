@@ -12,6 +12,7 @@
 #include <stdlib.h> 
 #include <arpa/inet.h>
 #include <functional>
+#include <csignal>
 
 #include "ofs_server.hpp"
 #include "../core/ofs_api.hpp"
@@ -22,6 +23,8 @@ using namespace std;
 
 OFSServer::OFSServer(int p) : port(p), server_fd(0), fs_instance(nullptr) {
     srand(time(NULL));
+    // A client that disconnects mid-download must not take the server down.
+    signal(SIGPIPE, SIG_IGN);
     initFileSystem();
     setupSocket();
 }
@@ -124,18 +127,44 @@ void OFSServer::listenLoop() {
 
 void OFSServer::processorLoop() {
     cout << "Processor thread started." << endl;
+    chrono::milliseconds idle_interval(((OFSInstance*)fs_instance)->config.maintenance_interval_ms);
     while (true) {
-        Request req = request_queue.pop();
+        Request req;
+        if (!request_queue.pop_for(req, idle_interval)) {
+            runMaintenance();
+            continue;
+        }
         cout << "Processing request for op: " << req.data.value("operation", "unknown") << endl;
         
         string response_str = processRequest(req.data);
         
         send(req.client_socket, response_str.c_str(), response_str.length(), 0);
+        if (pending_download.active) {
+            const Download& download = pending_download;
+            if (file_send(fs_instance, download.path.c_str(), download.offset, download.length, req.client_socket) != (int)OFSErrorCodes::SUCCESS) {
+                cerr << "file_download: transfer of " << download.path << " cut short." << endl;
+            }
+            pending_download = Download();
+        }
         close(req.client_socket);
         cout << "Response sent, client disconnected." << endl;
     }
 }
 
+// Background work runs on the processor thread only while the queue is idle, so it
+// never races the API and each step is bounded to keep foreground latency low.
+void OFSServer::runMaintenance() {
+    const Config& config = ((OFSInstance*)fs_instance)->config;
+    fs_flush_delayed(fs_instance, false);
+    fs_trim_appends(fs_instance, false);
+    fs_compact_fragments(fs_instance);
+    fs_flush_writeback(fs_instance, false);
+    fs_punch_freed(fs_instance, false);
+    if (config.defrag_enabled && config.defrag_blocks_per_step > 0) {
+        fs_defrag_step(fs_instance, config.defrag_blocks_per_step);
+    }
+}
+
 void OFSServer::handleClientConnection(int client_socket) {
     // Increase buffer size to handle larger requests
     char buffer[8192] = {0};
@@ -179,6 +208,17 @@ void OFSServer::handleClientConnection(int client_socket) {
     }
 }
 
+// Sizes arrive either as JSON numbers or as numeric strings; anything else is 0.
+static uint64_t parse_size_param(const json& value) {
+    if (value.is_number()) return value.get<uint64_t>();
+    if (value.is_string()) {
+        try {
+            return std::stoull(value.get<std::string>());
+        } catch (...) {}
+    }
+    return 0;
+}
+
 string OFSServer::processRequest(json req_data) {
     json response;
     string op = req_data.value("operation", "");
@@ -274,16 +314,7 @@ string OFSServer::processRequest(json req_data) {
                 else if (op == "file_create") { 
                     string path = req_data["parameters"]["path"];
                     
-                    // Robust size parsing
-                    size_t size = 0;
-                    if (req_data["parameters"]["size"].is_number()) {
-                        size = req_data["parameters"]["size"];
-                    } else if (req_data["parameters"]["size"].is_string()) {
-                        try {
-                            size = std::stoul(req_data["parameters"]["size"].get<std::string>());
-                        } catch (...) { size = 0; }
-                    }
-                    
+                    size_t size = parse_size_param(req_data["parameters"]["size"]);
                     result = file_create(fs_instance, path.c_str(), nullptr, size);
                 }
                 else if (op == "file_delete") {
@@ -306,29 +337,112 @@ string OFSServer::processRequest(json req_data) {
                             json entry;
                             entry["name"] = entries[i].name;
                             entry["type"] = (entries[i].getType() == EntryType::DIRECTORY) ? "directory" : "file";
-                            entry["size"] = (unsigned long)entries[i].size;
+                            entry["size"] = (uint64_t)entries[i].size;
                             entry_list.push_back(entry);
                         }
                         response["data"] = entry_list;
                         free_dir_list_memory(entries);
                     }
                 }
+                else if (op == "fs_grow") {
+                    // Resizing the container affects every user, so only admins may do it.
+                    if (session_check.user.role != UserRole::ADMIN) {
+                        result = (int)OFSErrorCodes::ERROR_PERMISSION_DENIED;
+                    } else {
+                        uint64_t size = parse_size_param(req_data["parameters"]["size"]);
+                        result = fs_grow(fs_instance, size);
+                    }
+                }
                 else if (op == "get_stats") {
                     FSStats stats;
                     result = get_stats(fs_instance, &stats);
                     if (result == (int)OFSErrorCodes::SUCCESS) {
-                        response["data"]["total_size"] = (unsigned long)stats.total_size;
-                        response["data"]["used_space"] = (unsigned long)stats.used_space;
-                        response["data"]["free_space"] = (unsigned long)stats.free_space;
+                        response["data"]["total_size"] = (uint64_t)stats.total_size;
+                        response["data"]["used_space"] = (uint64_t)stats.used_space;
+                        response["data"]["free_space"] = (uint64_t)stats.free_space;
                         response["data"]["total_files"] = stats.total_files;
                         response["data"]["total_directories"] = stats.total_directories;
                         response["data"]["total_users"] = stats.total_users;
                         response["data"]["active_sessions"] = stats.active_sessions;
+                        response["data"]["fragmentation"] = stats.fragmentation;
+                    }
+                    FreeSpaceStats free_space;
+                    if (result == (int)OFSErrorCodes::SUCCESS && get_free_space_stats(fs_instance, &free_space) == (int)OFSErrorCodes::SUCCESS) {
+                        response["data"]["free_extents"] = (uint64_t)free_space.free_extents;
+                        response["data"]["largest_free_extent"] = (uint64_t)free_space.largest_free_extent;
+                        response["data"]["reserved_blocks"] = (uint64_t)free_space.reserved_blocks;
+                        response["data"]["pending_bytes"] = (uint64_t)free_space.pending_bytes;
+                        response["data"]["append_slack_blocks"] = (uint64_t)free_space.append_slack_blocks;
+                        response["data"]["large_region_blocks"] = (uint64_t)free_space.large_region_blocks;
+                        response["data"]["large_free_blocks"] = (uint64_t)free_space.large_free_blocks;
+                        response["data"]["fragment_blocks"] = (uint64_t)free_space.fragment_blocks;
+                        response["data"]["packed_tails"] = (uint64_t)free_space.packed_tails;
+                        response["data"]["tail_bytes_reclaimed"] = (uint64_t)free_space.tail_bytes_reclaimed;
+                        response["data"]["punch_pending_blocks"] = (uint64_t)free_space.punch_pending_blocks;
+                        response["data"]["punched_blocks"] = (uint64_t)free_space.punched_blocks;
+                        json histogram = json::array();
+                        for (int i = 0; i < FreeSpaceBitmap::HISTOGRAM_BUCKETS; ++i) {
+                            if (free_space.free_run_histogram[i] == 0) continue;
+                            histogram.push_back({{"min_blocks", (uint64_t)1 << i}, {"runs", (uint64_t)free_space.free_run_histogram[i]}});
+                        }
+                        response["data"]["free_run_histogram"] = histogram;
+                    }
+                    DefragStats defrag;
+                    if (result == (int)OFSErrorCodes::SUCCESS && get_defrag_stats(fs_instance, &defrag) == (int)OFSErrorCodes::SUCCESS) {
+                        response["data"]["defrag"]["running"] = defrag.running;
+                        response["data"]["defrag"]["progress"] = defrag.progress;
+                        response["data"]["defrag"]["passes_completed"] = (uint64_t)defrag.passes_completed;
+                        response["data"]["defrag"]["files_moved"] = (uint64_t)defrag.files_moved;
+                        response["data"]["defrag"]["blocks_moved"] = (uint64_t)defrag.blocks_moved;
+                        response["data"]["defrag"]["bytes_moved"] = (uint64_t)defrag.bytes_moved;
+                        response["data"]["defrag"]["moves_aborted"] = (uint64_t)defrag.moves_aborted;
+                        response["data"]["defrag"]["files_promoted"] = (uint64_t)defrag.files_promoted;
+                    }
+                    BlockCacheStats cache;
+                    if (result == (int)OFSErrorCodes::SUCCESS && get_cache_stats(fs_instance, &cache) == (int)OFSErrorCodes::SUCCESS) {
+                        response["data"]["cache"]["capacity_blocks"] = cache.capacity_blocks;
+                        response["data"]["cache"]["resident_blocks"] = cache.resident_blocks;
+                        response["data"]["cache"]["hits"] = cache.hits;
+                        response["data"]["cache"]["misses"] = cache.misses;
+                        response["data"]["cache"]["evictions"] = cache.evictions;
+                        response["data"]["cache"]["recency_target"] = cache.recency_target;
+                        response["data"]["cache"]["prefetched_blocks"] = cache.prefetched_blocks;
+                        response["data"]["cache"]["prefetch_hits"] = cache.prefetch_hits;
+                        response["data"]["cache"]["dirty_blocks"] = cache.dirty_blocks;
+                        response["data"]["cache"]["written_back_blocks"] = cache.written_back_blocks;
+                        response["data"]["cache"]["write_back_runs"] = cache.write_back_runs;
+                    }
+                    FileCacheStats file_cache;
+                    if (result == (int)OFSErrorCodes::SUCCESS && get_file_cache_stats(fs_instance, &file_cache) == (int)OFSErrorCodes::SUCCESS) {
+                        response["data"]["file_cache"]["budget_bytes"] = file_cache.budget_bytes;
+                        response["data"]["file_cache"]["cached_bytes"] = file_cache.cached_bytes;
+                        response["data"]["file_cache"]["cached_files"] = file_cache.cached_files;
+                        response["data"]["file_cache"]["hits"] = file_cache.hits;
+                        response["data"]["file_cache"]["misses"] = file_cache.misses;
+                        response["data"]["file_cache"]["evictions"] = file_cache.evictions;
+                    }
+                    IOStats io;
+                    if (result == (int)OFSErrorCodes::SUCCESS && get_io_stats(fs_instance, &io) == (int)OFSErrorCodes::SUCCESS) {
+                        response["data"]["io"]["read_calls"] = io.read_calls;
+                        response["data"]["io"]["read_bytes"] = io.read_bytes;
+                        response["data"]["io"]["write_calls"] = io.write_calls;
+                        response["data"]["io"]["write_bytes"] = io.write_bytes;
+                        response["data"]["io"]["sendfile_calls"] = io.sendfile_calls;
+                        response["data"]["io"]["sendfile_bytes"] = io.sendfile_bytes;
+                        response["data"]["io"]["direct_calls"] = io.direct_calls;
+                        response["data"]["io"]["bounced_bytes"] = io.bounced_bytes;
                     }
                 }
                 else if (op == "file_truncate") {
                     string path = req_data["parameters"]["path"];
-                    result = file_truncate(fs_instance, path.c_str());
+                    uint64_t length = 0;
+                    if (req_data["parameters"].contains("length")) length = parse_size_param(req_data["parameters"]["length"]);
+                    result = file_truncate(fs_instance, path.c_str(), length);
+                }
+                else if (op == "file_allocate") {
+                    string path = req_data["parameters"]["path"];
+                    uint64_t length = parse_size_param(req_data["parameters"]["length"]);
+                    result = file_allocate(fs_instance, path.c_str(), length);
                 }
                 else if (op == "file_rename") {
                     string old_path = req_data["parameters"]["old_path"];
@@ -346,9 +460,10 @@ string OFSServer::processRequest(json req_data) {
                     if (result == (int)OFSErrorCodes::SUCCESS) {
                         response["data"]["path"] = meta.path;
                         response["data"]["entry"]["name"] = meta.entry.name;
-                        response["data"]["entry"]["size"] = (unsigned long)meta.entry.size;
+                        response["data"]["entry"]["size"] = (uint64_t)meta.entry.size;
                         response["data"]["entry"]["permissions"] = (unsigned int)meta.entry.permissions;
-                        response["data"]["blocks_used"] = (unsigned long)meta.blocks_used;
+                        response["data"]["blocks_used"] = (uint64_t)meta.blocks_used;
+                        response["data"]["actual_size"] = (uint64_t)meta.actual_size;
                     }
                 }
                 else if (op == "set_permissions") {
@@ -359,13 +474,50 @@ string OFSServer::processRequest(json req_data) {
                 else if (op == "file_edit") {
                     string path = req_data["parameters"]["path"];
                     string data = req_data["parameters"]["data"];
-                    result = file_edit(fs_instance, path.c_str(), data.c_str(), data.length(), 0);
+                    if (req_data["parameters"].contains("offset")) {
+                        uint64_t offset = parse_size_param(req_data["parameters"]["offset"]);
+                        result = file_edit(fs_instance, path.c_str(), data.c_str(), data.length(), offset);
+                    } else {
+                        result = file_write(fs_instance, path.c_str(), data.c_str(), data.length());
+                    }
+                }
+                else if (op == "file_append") {
+                    string path = req_data["parameters"]["path"];
+                    string data = req_data["parameters"]["data"];
+                    result = file_append(fs_instance, path.c_str(), data.c_str(), data.length());
+                }
+                else if (op == "file_download") {
+                    // Replies with a header line giving the byte count, then the raw bytes.
+                    string path = req_data["parameters"]["path"];
+                    uint64_t offset = 0;
+                    uint64_t length = UINT64_MAX;
+                    if (req_data["parameters"].contains("offset")) offset = parse_size_param(req_data["parameters"]["offset"]);
+                    if (req_data["parameters"].contains("length")) length = parse_size_param(req_data["parameters"]["length"]);
+                    FileMetadata meta;
+                    result = get_metadata(fs_instance, path.c_str(), &meta);
+                    if (result == (int)OFSErrorCodes::SUCCESS && meta.entry.getType() == EntryType::DIRECTORY) {
+                        result = (int)OFSErrorCodes::ERROR_NOT_FOUND;
+                    }
+                    if (result == (int)OFSErrorCodes::SUCCESS) {
+                        uint64_t size = offset < meta.entry.size ? min(length, meta.entry.size - offset) : 0;
+                        response["data"]["size"] = size;
+                        response["data"]["encoding"] = "raw";
+                        pending_download = {true, path, offset, size};
+                    }
                 }
                 else if (op == "file_read") {
                     string path = req_data["parameters"]["path"];
                     char* buffer = nullptr;
                     size_t size = 0;
-                    result = file_read(fs_instance, path.c_str(), &buffer, &size);
+                    if (req_data["parameters"].contains("offset") || req_data["parameters"].contains("length")) {
+                        uint64_t offset = 0;
+                        uint64_t length = UINT64_MAX;
+                        if (req_data["parameters"].contains("offset")) offset = parse_size_param(req_data["parameters"]["offset"]);
+                        if (req_data["parameters"].contains("length")) length = parse_size_param(req_data["parameters"]["length"]);
+                        result = file_read_range(fs_instance, path.c_str(), offset, length, &buffer, &size);
+                    } else {
+                        result = file_read(fs_instance, path.c_str(), &buffer, &size);
+                    }
                     if (result == (int)OFSErrorCodes::SUCCESS) {
                         if (buffer != nullptr) {
                             response["data"]["content"] = string(buffer, size);
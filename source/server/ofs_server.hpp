@@ -21,10 +21,20 @@ private:
     void* fs_instance;
     FifoQueue request_queue;
 
+    // file_download: the range to stream after the response header has been sent.
+    struct Download {
+        bool active = false;
+        string path;
+        uint64_t offset = 0;
+        uint64_t length = 0;
+    };
+    Download pending_download;
+
     void initFileSystem();
     void setupSocket();
     void listenLoop();
     void processorLoop();
+    void runMaintenance();
     void handleClientConnection(int client_socket);
     string processRequest(json req_data);
 };
\ No newline at end of file